@@ -0,0 +1,246 @@
+#ifndef PROGC_SRC_COLLECTIONS_CONSISTENT_HASH_RING_H
+#define PROGC_SRC_COLLECTIONS_CONSISTENT_HASH_RING_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "../extensions/serializable.h"
+#include "../data_types/wire_format.h"
+
+
+/*
+ Кольцо согласованного хеширования.
+ Каждый узел (хранилище) ставит на кольцо столько точек (виртуальных узлов), сколько ему задано,
+ ключ принадлежит узлу первой точки по часовой стрелке от хеша ключа.
+ При добавлении узла к нему переходит примерно 1/N ключей, остальные остаются на местах.
+ Положения точек зависят только от номера узла и номера точки, поэтому кольцо, собранное
+ из тех же узлов в другом процессе (сервер и хранилища), совпадает с исходным.
+ Кроме них на кольце могут быть точки разбиения, поставленные в заданные положения: так часть дуги
+ перегруженного узла отдаётся другому.
+ Сериализуется как | varint число узлов | varint число точек узла 0 | ... | varint число разбиений |
+ | varint положение | varint узел | ... |, 0 точек - узла нет.
+ */
+
+
+class ConsistentHashRing : public Serializable
+{
+public:
+
+	static inline const size_t DEFAULT_VIRTUAL_NODES = 128;
+
+private:
+
+	std::vector<size_t> virtual_nodes; // по номеру узла, 0 - узла на кольце нет
+	std::vector<std::pair<uint64_t, size_t>> splits; // точки разбиения (положение, узел), в порядке добавления
+	std::vector<std::pair<uint64_t, size_t>> points; // (положение, узел), по возрастанию
+
+	void rebuild()
+	{
+		points.clear();
+		for (size_t node = 0; node < virtual_nodes.size(); node++)
+		{
+			for (size_t replica = 0; replica < virtual_nodes[node]; replica++)
+			{
+				points.emplace_back(mix((static_cast<uint64_t>(node) << 32) | replica), node);
+			}
+		}
+		points.insert(points.end(), splits.begin(), splits.end());
+		std::sort(points.begin(), points.end());
+	}
+
+public:
+
+	// splitmix64: соседние числа расходятся по всему кольцу
+	static uint64_t mix(uint64_t value)
+	{
+		value += 0x9E3779B97F4A7C15ull;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		return value ^ (value >> 31);
+	}
+
+	// место ключа на кольце
+	static uint64_t positionOf(uint64_t keyHash)
+	{
+		return mix(keyHash);
+	}
+
+	ConsistentHashRing() = default;
+
+	// узлы 0 .. nodeCount - 1, у каждого virtualNodes точек
+	ConsistentHashRing(size_t nodeCount, size_t virtualNodes) : virtual_nodes(nodeCount, virtualNodes)
+	{
+		rebuild();
+	}
+
+	void addNode(size_t node, size_t virtualNodes = DEFAULT_VIRTUAL_NODES)
+	{
+		if (virtualNodes < 1)
+			throw std::runtime_error("Node must have at least one virtual node");
+		if (node >= virtual_nodes.size())
+			virtual_nodes.resize(node + 1, 0);
+		virtual_nodes[node] = virtualNodes;
+		rebuild();
+	}
+
+	void removeNode(size_t node)
+	{
+		if (node < virtual_nodes.size())
+			virtual_nodes[node] = 0;
+		splits.erase(std::remove_if(splits.begin(), splits.end(), [node](const std::pair<uint64_t, size_t>& split)
+		{ return split.second == node; }), splits.end());
+		rebuild();
+	}
+
+	// ключи дуги, в которую попало position, до position включительно переходят к узлу node
+	void addSplit(uint64_t position, size_t node)
+	{
+		if (getVirtualNodes(node) == 0)
+			throw std::runtime_error("Split must belong to a node on the ring");
+		splits.emplace_back(position, node);
+		rebuild();
+	}
+
+	const std::vector<std::pair<uint64_t, size_t>>& getSplits() const
+	{
+		return splits;
+	}
+
+	bool empty() const
+	{
+		return points.empty();
+	}
+
+	// сколько точек у узла, 0 - узла нет
+	size_t getVirtualNodes(size_t node) const
+	{
+		return node < virtual_nodes.size() ? virtual_nodes[node] : 0;
+	}
+
+	size_t nodeFor(uint64_t keyHash) const
+	{
+		return ownerOf(positionOf(keyHash));
+	}
+
+	// узел первой точки не раньше position
+	size_t ownerOf(uint64_t position) const
+	{
+		if (points.empty())
+			throw std::runtime_error("Hash ring is empty");
+		auto point = std::lower_bound(points.begin(), points.end(), std::make_pair(position, size_t(0)));
+		if (point == points.end())
+			point = points.begin();
+		return point->second;
+	}
+
+	// дуга (начало, конец], которой принадлежит position: от предыдущей точки до точки владельца
+	std::pair<uint64_t, uint64_t> arcOf(uint64_t position) const
+	{
+		if (points.empty())
+			throw std::runtime_error("Hash ring is empty");
+		auto point = std::lower_bound(points.begin(), points.end(), std::make_pair(position, size_t(0)));
+		if (point == points.end())
+			point = points.begin();
+		auto previous = point == points.begin() ? points.end() - 1 : point - 1;
+		return { previous->first, point->first };
+	}
+
+	// первые count разных узлов по часовой стрелке от ключа: первый - основной, остальные - реплики
+	std::vector<size_t> nodesFor(uint64_t keyHash, size_t count) const
+	{
+		return ownersOf(positionOf(keyHash), count);
+	}
+
+	std::vector<size_t> ownersOf(uint64_t position, size_t count) const
+	{
+		if (points.empty())
+			throw std::runtime_error("Hash ring is empty");
+		count = std::min(count, nodeCount());
+		std::vector<size_t> result;
+		auto point = std::lower_bound(points.begin(), points.end(), std::make_pair(position, size_t(0)));
+		for (size_t i = 0; i < points.size() && result.size() < count; i++, point++)
+		{
+			if (point == points.end())
+				point = points.begin();
+			if (std::find(result.begin(), result.end(), point->second) == result.end())
+				result.push_back(point->second);
+		}
+		return result;
+	}
+
+	// сколько узлов на кольце
+	size_t nodeCount() const
+	{
+		return virtual_nodes.size() - std::count(virtual_nodes.begin(), virtual_nodes.end(), size_t(0));
+	}
+
+	std::vector<uint64_t> getPositions() const
+	{
+		std::vector<uint64_t> positions;
+		positions.reserve(points.size());
+		for (const auto& point: points)
+			positions.push_back(point.first);
+		return positions;
+	}
+
+	size_t serializedSize() const override
+	{
+		size_t size = WireFormat::varintSize(virtual_nodes.size());
+		for (size_t count: virtual_nodes)
+			size += WireFormat::varintSize(count);
+		size += WireFormat::varintSize(splits.size());
+		for (const auto& split: splits)
+			size += WireFormat::varintSize(split.first) + WireFormat::varintSize(split.second);
+		return size;
+	}
+
+	void serializeTo(char* buffer) const override
+	{
+		buffer = WireFormat::writeVarint(buffer, virtual_nodes.size());
+		for (size_t count: virtual_nodes)
+			buffer = WireFormat::writeVarint(buffer, count);
+		buffer = WireFormat::writeVarint(buffer, splits.size());
+		for (const auto& split: splits)
+		{
+			buffer = WireFormat::writeVarint(buffer, split.first);
+			buffer = WireFormat::writeVarint(buffer, split.second);
+		}
+	}
+
+	std::string serialize() const override
+	{
+		std::string result(serializedSize(), '\0');
+		serializeTo(&result[0]);
+		return result;
+	}
+
+	static ConsistentHashRing deserialize(std::string_view serializedRing)
+	{
+		const char* ptr = serializedRing.data();
+		return read(ptr);
+	}
+
+	// ptr сдвигается за прочитанное кольцо
+	static ConsistentHashRing read(const char*& ptr)
+	{
+		ConsistentHashRing result;
+		result.virtual_nodes.resize(WireFormat::readVarint(ptr));
+		for (size_t& count: result.virtual_nodes)
+			count = WireFormat::readVarint(ptr);
+		result.splits.resize(WireFormat::readVarint(ptr));
+		for (auto& split: result.splits)
+		{
+			split.first = WireFormat::readVarint(ptr);
+			split.second = WireFormat::readVarint(ptr);
+		}
+		result.rebuild();
+		return result;
+	}
+};
+
+
+#endif //PROGC_SRC_COLLECTIONS_CONSISTENT_HASH_RING_H
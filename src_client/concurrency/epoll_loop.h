@@ -0,0 +1,127 @@
+#ifndef PROGC_SRC_CONCURRENCY_EPOLL_LOOP_H
+#define PROGC_SRC_CONCURRENCY_EPOLL_LOOP_H
+
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+/*
+ Цикл epoll в отдельном потоке. Следит за дескрипторами и копит готовые к чтению,
+ а владельца будит через onReady (сервер звонит в свой SharedEvent), так что
+ обработчику не нужно опрашивать каждое соединение на каждом такте.
+ Дескрипторы взводятся с EPOLLONESHOT: после обработки их нужно взвести снова через rearm.
+ */
+
+
+class EpollLoop
+{
+private:
+
+	static inline const int MAX_EVENTS = 256;
+
+	const int epoll_descriptor;
+	const int stop_descriptor;
+	std::function<void()> on_ready;
+	std::mutex ready_mutex;
+	std::vector<int> ready;
+	std::atomic<bool> stopped{ false };
+	std::thread worker;
+
+	void control(int operation, int descriptor)
+	{
+		epoll_event event{};
+		event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		event.data.fd = descriptor;
+		if (epoll_ctl(epoll_descriptor, operation, descriptor, &event) < 0 && operation != EPOLL_CTL_MOD)
+			throw std::runtime_error("Unable to watch descriptor");
+	}
+
+	void run()
+	{
+		epoll_event events[MAX_EVENTS];
+		while (!stopped.load())
+		{
+			int count = epoll_wait(epoll_descriptor, events, MAX_EVENTS, -1);
+			if (count <= 0)
+				continue;
+			bool any = false;
+			{
+				std::lock_guard<std::mutex> lock(ready_mutex);
+				for (int i = 0; i < count; i++)
+				{
+					if (events[i].data.fd == stop_descriptor)
+						continue;
+					ready.push_back(events[i].data.fd);
+					any = true;
+				}
+			}
+			if (any)
+				on_ready();
+		}
+	}
+
+public:
+
+	explicit EpollLoop(std::function<void()> onReady)
+			: epoll_descriptor(epoll_create1(EPOLL_CLOEXEC)), stop_descriptor(eventfd(0, EFD_CLOEXEC)),
+			  on_ready(std::move(onReady))
+	{
+		if (epoll_descriptor < 0 || stop_descriptor < 0)
+			throw std::runtime_error("Unable to create epoll loop");
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.fd = stop_descriptor;
+		epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, stop_descriptor, &event);
+		worker = std::thread(&EpollLoop::run, this);
+	}
+
+	~EpollLoop()
+	{
+		stopped.store(true);
+		uint64_t one = 1;
+		write(stop_descriptor, &one, sizeof(one));
+		worker.join();
+		close(stop_descriptor);
+		close(epoll_descriptor);
+	}
+
+	void watch(int descriptor)
+	{
+		control(EPOLL_CTL_ADD, descriptor);
+	}
+
+	void rearm(int descriptor)
+	{
+		control(EPOLL_CTL_MOD, descriptor);
+	}
+
+	// закрытый дескриптор epoll забывает сам, unwatch нужен только для ещё открытых
+	void unwatch(int descriptor)
+	{
+		epoll_ctl(epoll_descriptor, EPOLL_CTL_DEL, descriptor, nullptr);
+	}
+
+	// готовые с прошлого вызова дескрипторы
+	std::vector<int> takeReady()
+	{
+		std::vector<int> result;
+		std::lock_guard<std::mutex> lock(ready_mutex);
+		result.swap(ready);
+		return result;
+	}
+
+	EpollLoop(const EpollLoop&) = delete;
+
+	EpollLoop& operator=(const EpollLoop&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONCURRENCY_EPOLL_LOOP_H
@@ -6,6 +6,7 @@
 #include <optional>
 #include <boost/interprocess/mapped_region.hpp>
 #include "../extensions/serializable.h"
+#include "../concurrency/shared_event.h"
 
 
 class Connection
@@ -23,8 +24,40 @@ public:
 
 	virtual const char* receiveMessage() const = 0;
 
+	// сколько байт доступно с начала кадра receiveMessage; заголовок, обещающий больше, не читается
+	virtual size_t receiveSize() const = 0;
+
 	virtual void sendMessage(const Serializable&) const = 0;
 
+	// есть ли кадр от другой стороны; statusCode - код читающей стороны
+	virtual bool hasMessage(int statusCode) const
+	{
+		return *receiveMessage() != static_cast<char>(statusCode);
+	}
+
+	// освобождает кадр, полученный через receiveMessage
+	// (в однослотовом соединении его место займёт ответ, поэтому ничего не делаем)
+	virtual void popMessage() const
+	{
+	}
+
+	// event будет звонить при каждом кадре, отправленном этой стороне
+	virtual void setReceiveEvent(const SharedEvent&) const
+	{
+	}
+
+	// поместится ли кадр из size байт сразу, без ожидания другой стороны
+	virtual bool canSend(size_t) const
+	{
+		return true;
+	}
+
+	// сколько кадров можно отправить, не дожидаясь ответов
+	virtual size_t capacity() const
+	{
+		return 1;
+	}
+
 	virtual ~Connection() = default;
 };
 
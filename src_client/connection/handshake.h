@@ -0,0 +1,45 @@
+#ifndef PROGC_SRC_CONNECTION_HANDSHAKE_H
+#define PROGC_SRC_CONNECTION_HANDSHAKE_H
+
+
+#include <optional>
+#include <random>
+#include <string>
+#include "./memory_connection.h"
+#include "./mpsc_ring_connection.h"
+#include "../concurrency/shared_event.h"
+#include "../concurrency/wait_strategy.h"
+#include "../data_types/shared_object.h"
+
+
+/*
+ Запрос соединения у сервера.
+ Запрос (GET_CONNECTION_CLIENT / GET_CONNECTION_STORAGE) кладётся в общий канал подключения,
+ в который пишут все процессы сразу, а в данных указывается имя собственного ящика для ответа.
+ Ответ сервера (имя выделенного соединения) приходит в этот ящик, поэтому подключающимся
+ не нужно занимать общий мьютекс на время ожидания.
+ */
+
+
+inline std::optional<std::string> requestConnection(const std::string& memNameForConnect, int statusCode,
+		SharedObject::RequestResponseCode request, const SharedEvent& event, WaitStrategy& waitStrategy)
+{
+	std::string replyName = memNameForConnect + "_reply" + std::to_string(std::random_device()());
+	MemoryConnection reply(true, replyName);
+	reply.setReceiveEvent(event);
+	// пока сервер не ответил, в ящике лежит свой же кадр
+	reply.sendMessage(SharedObject(statusCode, SharedObject::RequestResponseCode::OK, SharedObject::NULL_DATA));
+
+	MpscRingConnection connect_connection(false, memNameForConnect);
+	connect_connection.sendMessage(SharedObject(statusCode, request, replyName));
+	waitStrategy.waitFor(event, [&]
+	{ return reply.hasMessage(statusCode); });
+
+	auto response = SharedObject::deserialize(reply.receiveMessage(), reply.receiveSize());
+	if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
+		return std::nullopt;
+	return response.getData();
+}
+
+
+#endif //PROGC_SRC_CONNECTION_HANDSHAKE_H
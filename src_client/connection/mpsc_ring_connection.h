@@ -0,0 +1,305 @@
+#ifndef PROGC_SRC_CONNECTION_MPSC_RING_CONNECTION_H
+#define PROGC_SRC_CONNECTION_MPSC_RING_CONNECTION_H
+
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+#include <thread>
+#include <stdexcept>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "./connection.h"
+#include "./connection_events.h"
+#include "../extensions/serializable.h"
+
+
+using namespace boost::interprocess;
+
+
+/*
+ Односторонний канал "много писателей -> один читатель" в разделяемой памяти без межпроцессного мьютекса.
+ У каждого слота свой номер версии (sequence):
+ слот на позиции p свободен для записи, если sequence == p, и готов к чтению, если sequence == p + 1.
+ Писатель занимает позицию атомарным compare_exchange на head, пишет кадр и публикует его,
+ записывая sequence = p + 1 (release). Читатель освобождает слот, записывая sequence = p + slot_count.
+ Поэтому медленный писатель задерживает только чтение своего кадра, а не других писателей.
+ Кадр длиннее слота режется на фрагменты; фрагменты разных писателей могут перемешаться,
+ так что в слоте хранится номер писателя, и читатель собирает кадры каждого писателя отдельно.
+ Сегмент: | Header | слоты |, слот: | SlotHeader | кадр или его фрагмент |
+ */
+
+
+class MpscRingConnection : public Connection
+{
+public:
+
+	static inline const size_t DEFAULT_SLOT_COUNT = 64;
+	static inline const size_t DEFAULT_SLOT_SIZE = 1024;
+
+private:
+
+	static_assert(std::atomic<size_t>::is_always_lock_free,
+			"Slot sequences are shared between processes and must be lock-free");
+
+	struct alignas(64) RingIndex
+	{
+		std::atomic<size_t> value;
+	};
+
+	struct SlotHeader
+	{
+		static inline const uint32_t MORE_FRAGMENTS = 1;
+
+		std::atomic<size_t> sequence;
+		uint64_t producer;
+		uint32_t length;
+		uint32_t flags;
+	};
+
+	struct Header
+	{
+		EventNames event_names; // 0 - событие читателя
+		size_t slot_count;
+		size_t slot_size;
+		RingIndex head; // следующая позиция для записи, двигают писатели
+	};
+
+	mapped_region* mreg;
+	Header* header;
+	const bool is_reader;
+	ConnectionEvents events;
+	const uint64_t producer_id;
+	mutable size_t tail = 0; // следующая позиция для чтения, двигает только читатель
+	mutable std::map<uint64_t, std::string> partial; // недособранные кадры по писателям
+	mutable std::string assembled;
+	mutable bool assembled_ready = false;
+
+	size_t slotStride() const
+	{
+		return sizeof(SlotHeader) + header->slot_size;
+	}
+
+	static size_t segmentSize(size_t slotCount, size_t slotSize)
+	{
+		return sizeof(Header) + slotCount * (sizeof(SlotHeader) + slotSize);
+	}
+
+	SlotHeader* slot(size_t position) const
+	{
+		char* slots = reinterpret_cast<char*>(header + 1);
+		return reinterpret_cast<SlotHeader*>(slots + (position % header->slot_count) * slotStride());
+	}
+
+	static char* slotData(SlotHeader* slotHeader)
+	{
+		return reinterpret_cast<char*>(slotHeader + 1);
+	}
+
+	// длину пишет другой процесс, поэтому за слот она не выходит
+	size_t slotLength(const SlotHeader* slotHeader) const
+	{
+		return std::min<size_t>(slotHeader->length, header->slot_size);
+	}
+
+	// занимает позицию для записи; false - кольцо заполнено
+	bool claim(size_t& position) const
+	{
+		position = header->head.value.load(std::memory_order_relaxed);
+		while (true)
+		{
+			size_t sequence = slot(position)->sequence.load(std::memory_order_acquire);
+			auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+			if (difference == 0)
+			{
+				if (header->head.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					return true;
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = header->head.value.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void publish(size_t position, size_t length, uint32_t flags) const
+	{
+		SlotHeader* slotHeader = slot(position);
+		slotHeader->producer = producer_id;
+		slotHeader->length = static_cast<uint32_t>(length);
+		slotHeader->flags = flags;
+		slotHeader->sequence.store(position + 1, std::memory_order_release);
+		events.notifyPeer();
+	}
+
+	void release() const
+	{
+		slot(tail)->sequence.store(tail + header->slot_count, std::memory_order_release);
+		tail++;
+	}
+
+public:
+
+	// isReader - читатель (создаёт сегмент), писатели открывают уже созданный
+	MpscRingConnection(bool isReader, const std::string& memoryName, size_t slotCount = DEFAULT_SLOT_COUNT,
+			size_t slotSize = DEFAULT_SLOT_SIZE)
+			: is_reader(isReader), producer_id((static_cast<uint64_t>(std::random_device()()) << 32)
+											   | std::random_device()())
+	{
+		Connection::connectionName = memoryName;
+		if (is_reader)
+		{
+			if (slotCount < 1 || slotSize < 1)
+				throw std::runtime_error("Ring must have at least one non-empty slot");
+			slotSize = (slotSize + alignof(size_t) - 1) / alignof(size_t) * alignof(size_t);
+			try
+			{ shared_memory_object::remove(Connection::connectionName.c_str()); }
+			catch (...)
+			{}
+			shared_memory_object shm(create_only, Connection::connectionName.c_str(), read_write);
+			shm.truncate(static_cast<offset_t>(segmentSize(slotCount, slotSize)));
+			mreg = new mapped_region(shm, read_write);
+			header = new(mreg->get_address()) Header();
+			header->slot_count = slotCount;
+			header->slot_size = slotSize;
+			header->head.value.store(0, std::memory_order_relaxed);
+			for (size_t i = 0; i < slotCount; i++)
+			{
+				new(slot(i)) SlotHeader();
+				slot(i)->sequence.store(i, std::memory_order_relaxed);
+			}
+			events.attach(&header->event_names, true, true);
+		}
+		else
+		{
+			shared_memory_object shm(open_only, Connection::connectionName.c_str(), read_write);
+			mreg = new mapped_region(shm, read_write);
+			header = static_cast<Header*>(mreg->get_address());
+			events.attach(&header->event_names, false, false);
+		}
+	}
+
+	~MpscRingConnection() override
+	{
+		if (is_reader)
+		{
+			shared_memory_object::remove(Connection::connectionName.c_str());
+		}
+		delete mreg;
+	}
+
+	bool hasMessage(int) const override
+	{
+		if (assembled_ready)
+			return true;
+		while (true)
+		{
+			SlotHeader* slotHeader = slot(tail);
+			if (slotHeader->sequence.load(std::memory_order_acquire) != tail + 1)
+				return false;
+			bool last = !(slotHeader->flags & SlotHeader::MORE_FRAGMENTS);
+			auto producer = partial.find(slotHeader->producer);
+			if (last && producer == partial.end())
+				return true;
+			std::string& frame = partial[slotHeader->producer];
+			frame.append(slotData(slotHeader), slotLength(slotHeader));
+			if (last)
+			{
+				assembled = std::move(frame);
+				partial.erase(slotHeader->producer);
+				assembled_ready = true;
+			}
+			release();
+			if (last)
+				return true;
+		}
+	}
+
+	// кадр действителен до popMessage
+	const char* receiveMessage() const override
+	{
+		if (assembled_ready)
+			return assembled.c_str();
+		return slotData(slot(tail));
+	}
+
+	size_t receiveSize() const override
+	{
+		if (assembled_ready)
+			return assembled.length();
+		return slotLength(slot(tail));
+	}
+
+	void popMessage() const override
+	{
+		if (assembled_ready)
+		{
+			assembled.clear();
+			assembled_ready = false;
+			return;
+		}
+		release();
+	}
+
+	void setReceiveEvent(const SharedEvent& event) const override
+	{
+		events.subscribe(event);
+	}
+
+	size_t capacity() const override
+	{
+		return header->slot_count;
+	}
+
+	// false - кольцо заполнено и ничего не отправлено; начатый кадр дописывается до конца
+	bool trySendMessage(const Serializable& data) const
+	{
+		size_t position;
+		size_t frameSize = data.serializedSize();
+		if (frameSize <= header->slot_size)
+		{
+			if (!claim(position))
+				return false;
+			data.serializeTo(slotData(slot(position)));
+			publish(position, frameSize, 0);
+			return true;
+		}
+
+		if (!claim(position))
+			return false;
+		std::string str = data.serialize();
+		size_t offset = 0;
+		while (true)
+		{
+			size_t length = std::min(header->slot_size, str.length() - offset);
+			memcpy(slotData(slot(position)), str.c_str() + offset, length);
+			offset += length;
+			bool last = offset == str.length();
+			publish(position, length, last ? 0 : SlotHeader::MORE_FRAGMENTS);
+			if (last)
+				return true;
+			while (!claim(position))
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// если кольцо заполнено - ждёт, пока читатель освободит слот
+	void sendMessage(const Serializable& data) const override
+	{
+		while (!trySendMessage(data))
+		{
+			std::this_thread::yield();
+		}
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_MPSC_RING_CONNECTION_H
@@ -0,0 +1,413 @@
+#ifndef PROGC_SRC_CONNECTION_RING_CONNECTION_H
+#define PROGC_SRC_CONNECTION_RING_CONNECTION_H
+
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "./connection.h"
+#include "./connection_events.h"
+#include "../extensions/serializable.h"
+
+
+using namespace boost::interprocess;
+
+
+/*
+ Соединение через разделяемую память с двумя кольцевыми буферами (по одному на направление).
+ В каждом кольце ровно один писатель и один читатель, поэтому достаточно двух атомарных индексов:
+ head двигает только писатель, tail - только читатель.
+ Сегмент: | Header (с именами событий сторон) | слоты кольца "к серверу" | слоты кольца "к клиенту" |
+ Слот: | SlotHeader | кадр (SharedObject) или его фрагмент |
+ Кадр длиннее слота режется на фрагменты по соседним слотам; у всех, кроме последнего, стоит MORE_FRAGMENTS.
+ Читатель собирает фрагменты в локальный буфер и сразу освобождает их слоты,
+ так что кадр может быть больше всего кольца.
+ Сервер пишет клиентам из потоков пула, поэтому его сторона (buffered) не ждёт читателя: кадры, не влезшие
+ в кольцо, копятся в outbound и дописываются следующими отправками и flush. Клиент, который не освобождает
+ слоты дольше WRITE_TIMEOUT или набрал больше OUTBOUND_LIMIT, отключается - иначе он держал бы поток пула.
+ */
+
+
+class RingConnection : public Connection
+{
+public:
+
+	static inline const size_t DEFAULT_SLOT_COUNT = 64;
+	static inline const size_t DEFAULT_SLOT_SIZE = 1024;
+	static inline const size_t OUTBOUND_LIMIT = 64 * 1024 * 1024;
+	static inline const std::chrono::seconds WRITE_TIMEOUT{ 10 };
+
+private:
+
+	static_assert(std::atomic<size_t>::is_always_lock_free,
+			"Ring indexes are shared between processes and must be lock-free");
+
+	// индексы на разных кэш-линиях, чтобы писатель и читатель не мешали друг другу
+	struct alignas(64) RingIndex
+	{
+		std::atomic<size_t> value;
+	};
+
+	struct Ring
+	{
+		RingIndex head; // следующий слот для записи
+		RingIndex tail; // следующий слот для чтения
+	};
+
+	struct SlotHeader
+	{
+		static inline const uint32_t MORE_FRAGMENTS = 1;
+
+		uint32_t length;
+		uint32_t flags;
+	};
+
+	struct Header
+	{
+		EventNames event_names;
+		size_t slot_count;
+		size_t slot_size;
+		Ring rings[2]; // 0 - к серверу, 1 - к клиенту
+	};
+
+	mapped_region* mreg;
+	Header* header;
+	const bool is_server;
+	ConnectionEvents events;
+	mutable std::string assembled; // собранный из фрагментов входящий кадр
+	mutable bool assembled_ready = false;
+	const bool buffered;
+	mutable std::atomic<bool> closed{ false };
+	mutable std::mutex outbound_mutex; // пишут потоки пула, дописывает главный поток
+	mutable std::deque<std::string> outbound; // кадры, ещё не записанные в кольцо (только buffered)
+	mutable size_t outbound_offset = 0; // сколько байт первого кадра уже записано
+	mutable size_t outbound_bytes = 0;
+	mutable std::atomic<bool> has_outbound{ false };
+	mutable std::chrono::steady_clock::time_point outbound_since; // когда читатель последний раз освободил слот
+
+	size_t slotStride() const
+	{
+		return sizeof(SlotHeader) + header->slot_size;
+	}
+
+	static size_t segmentSize(size_t slotCount, size_t slotSize)
+	{
+		return sizeof(Header) + 2 * slotCount * (sizeof(SlotHeader) + slotSize);
+	}
+
+	char* slot(int ring, size_t index) const
+	{
+		char* slots = reinterpret_cast<char*>(header + 1) + ring * header->slot_count * slotStride();
+		return slots + (index % header->slot_count) * slotStride();
+	}
+
+	// длину пишет другая сторона, поэтому за слот она не выходит
+	size_t slotLength(const SlotHeader* slotHeader) const
+	{
+		return std::min<size_t>(slotHeader->length, header->slot_size);
+	}
+
+	int inboundRing() const
+	{
+		return is_server ? 0 : 1;
+	}
+
+	int outboundRing() const
+	{
+		return is_server ? 1 : 0;
+	}
+
+	// пишет кадр или его фрагмент в свободный слот, не звоня другой стороне
+	void writeSlot(const char* data, size_t length, bool moreFragments) const
+	{
+		Ring& ring = header->rings[outboundRing()];
+		size_t head = ring.head.value.load(std::memory_order_relaxed);
+		char* address = slot(outboundRing(), head);
+		auto* slotHeader = reinterpret_cast<SlotHeader*>(address);
+		slotHeader->length = static_cast<uint32_t>(length);
+		slotHeader->flags = moreFragments ? SlotHeader::MORE_FRAGMENTS : 0;
+		memcpy(address + sizeof(SlotHeader), data, length);
+		ring.head.value.store(head + 1, std::memory_order_release);
+	}
+
+	// кадр из одного слота пишется сразу в слот, без промежуточной строки; слот должен быть свободен
+	void writeFrame(const Serializable& data, size_t frameSize) const
+	{
+		Ring& ring = header->rings[outboundRing()];
+		size_t head = ring.head.value.load(std::memory_order_relaxed);
+		char* address = slot(outboundRing(), head);
+		data.serializeTo(address + sizeof(SlotHeader));
+		auto* slotHeader = reinterpret_cast<SlotHeader*>(address);
+		slotHeader->length = static_cast<uint32_t>(frameSize);
+		slotHeader->flags = 0;
+		ring.head.value.store(head + 1, std::memory_order_release);
+	}
+
+	// вызывается под outbound_mutex
+	void flushOutbound() const
+	{
+		auto now = std::chrono::steady_clock::now();
+		bool written = false;
+		while (!outbound.empty() && !isFull())
+		{
+			const std::string& frame = outbound.front();
+			size_t length = std::min(header->slot_size, frame.length() - outbound_offset);
+			writeSlot(frame.data() + outbound_offset, length, outbound_offset + length < frame.length());
+			outbound_offset += length;
+			outbound_bytes -= length;
+			written = true;
+			if (outbound_offset == frame.length())
+			{
+				outbound.pop_front();
+				outbound_offset = 0;
+			}
+		}
+		if (written)
+		{
+			outbound_since = now;
+			events.notifyPeer();
+		}
+		if (!outbound.empty() && (outbound_bytes > OUTBOUND_LIMIT || now - outbound_since > WRITE_TIMEOUT))
+			disconnect();
+		has_outbound = !outbound.empty();
+	}
+
+	// вызывается под outbound_mutex; недописанный кадр остаётся в кольце, но читать его уже некому
+	void disconnect() const
+	{
+		closed = true;
+		outbound.clear();
+		outbound_offset = 0;
+		outbound_bytes = 0;
+	}
+
+	void sendBuffered(const Serializable& data) const
+	{
+		size_t frameSize = data.serializedSize();
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		if (closed)
+			return;
+		if (outbound.empty() && frameSize <= header->slot_size && !isFull())
+		{
+			writeFrame(data, frameSize);
+			events.notifyPeer();
+			return;
+		}
+		if (outbound.empty())
+			outbound_since = std::chrono::steady_clock::now();
+		outbound.push_back(data.serialize());
+		outbound_bytes += frameSize;
+		flushOutbound();
+	}
+
+public:
+
+	// buffered - отправка не ждёт другую сторону (кольца клиентов сервера, см. flush)
+	RingConnection(bool isServer, const std::string& memoryName, size_t slotCount = DEFAULT_SLOT_COUNT,
+			size_t slotSize = DEFAULT_SLOT_SIZE, bool buffered = false) : is_server(isServer), buffered(buffered)
+	{
+		Connection::connectionName = memoryName;
+		if (is_server)
+		{
+			if (slotCount < 1 || slotSize < 1)
+				throw std::runtime_error("Ring must have at least one non-empty slot");
+			slotSize = (slotSize + alignof(size_t) - 1) / alignof(size_t) * alignof(size_t);
+			try
+			{ shared_memory_object::remove(Connection::connectionName.c_str()); }
+			catch (...)
+			{}
+			shared_memory_object shm(create_only, Connection::connectionName.c_str(), read_write);
+			shm.truncate(static_cast<offset_t>(segmentSize(slotCount, slotSize)));
+			mreg = new mapped_region(shm, read_write);
+			header = new(mreg->get_address()) Header();
+			header->slot_count = slotCount;
+			header->slot_size = slotSize;
+			for (auto& ring: header->rings)
+			{
+				ring.head.value.store(0, std::memory_order_relaxed);
+				ring.tail.value.store(0, std::memory_order_relaxed);
+			}
+			events.attach(&header->event_names, is_server, true);
+		}
+		else
+		{
+			shared_memory_object shm(open_only, Connection::connectionName.c_str(), read_write);
+			mreg = new mapped_region(shm, read_write);
+			header = static_cast<Header*>(mreg->get_address());
+			events.attach(&header->event_names, is_server, false);
+		}
+	}
+
+	~RingConnection() override
+	{
+		if (is_server)
+		{
+			shared_memory_object::remove(Connection::connectionName.c_str());
+		}
+		delete mreg;
+	}
+
+	// кадр из одного слота читается на месте, фрагменты переносятся в assembled по мере прихода
+	bool hasMessage(int) const override
+	{
+		if (closed)
+			return false;
+		if (assembled_ready)
+			return true;
+		Ring& ring = header->rings[inboundRing()];
+		size_t head = ring.head.value.load(std::memory_order_acquire);
+		size_t tail = ring.tail.value.load(std::memory_order_relaxed);
+		while (tail != head)
+		{
+			const char* address = slot(inboundRing(), tail);
+			const auto* slotHeader = reinterpret_cast<const SlotHeader*>(address);
+			bool last = !(slotHeader->flags & SlotHeader::MORE_FRAGMENTS);
+			if (last && assembled.empty())
+				return true;
+			assembled.append(address + sizeof(SlotHeader), slotLength(slotHeader));
+			tail++;
+			ring.tail.value.store(tail, std::memory_order_release);
+			if (last)
+			{
+				assembled_ready = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// кадр в голове входящего кольца, действителен до popMessage
+	const char* receiveMessage() const override
+	{
+		if (assembled_ready)
+			return assembled.c_str();
+		const Ring& ring = header->rings[inboundRing()];
+		return slot(inboundRing(), ring.tail.value.load(std::memory_order_relaxed)) + sizeof(SlotHeader);
+	}
+
+	size_t receiveSize() const override
+	{
+		if (assembled_ready)
+			return assembled.length();
+		const Ring& ring = header->rings[inboundRing()];
+		return slotLength(reinterpret_cast<const SlotHeader*>(slot(inboundRing(),
+				ring.tail.value.load(std::memory_order_relaxed))));
+	}
+
+	void popMessage() const override
+	{
+		if (assembled_ready)
+		{
+			assembled.clear();
+			assembled_ready = false;
+			return;
+		}
+		Ring& ring = header->rings[inboundRing()];
+		ring.tail.value.store(ring.tail.value.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void setReceiveEvent(const SharedEvent& event) const override
+	{
+		events.subscribe(event);
+	}
+
+	bool isFull() const
+	{
+		const Ring& ring = header->rings[outboundRing()];
+		return ring.head.value.load(std::memory_order_relaxed) - ring.tail.value.load(std::memory_order_acquire)
+			   == header->slot_count;
+	}
+
+	size_t capacity() const override
+	{
+		return header->slot_count;
+	}
+
+	// хватает ли свободных слотов на все фрагменты; кадр больше кольца пишется только в пустое кольцо
+	bool canSend(size_t size) const override
+	{
+		const Ring& ring = header->rings[outboundRing()];
+		size_t used = ring.head.value.load(std::memory_order_relaxed) - ring.tail.value.load(std::memory_order_acquire);
+		size_t free = header->slot_count - used;
+		return free == header->slot_count || free * header->slot_size >= size;
+	}
+
+	size_t getSlotSize() const
+	{
+		return header->slot_size;
+	}
+
+	// заранее выделяет все страницы сегмента, чтобы первые кадры не ловили page fault
+	void prefault() const
+	{
+		auto* address = static_cast<volatile char*>(mreg->get_address());
+		size_t pageSize = mapped_region::get_page_size();
+		for (size_t offset = sizeof(Header); offset < mreg->get_size(); offset += pageSize)
+		{
+			address[offset] = 0;
+		}
+	}
+
+	// если кольцо заполнено - ждёт, пока читатель освободит слот (кроме buffered)
+	void sendMessage(const Serializable& data) const override
+	{
+		if (buffered)
+		{
+			sendBuffered(data);
+			return;
+		}
+		size_t frameSize = data.serializedSize();
+		if (frameSize <= header->slot_size)
+		{
+			while (isFull())
+			{
+				std::this_thread::yield();
+			}
+			writeFrame(data, frameSize);
+			events.notifyPeer();
+			return;
+		}
+
+		std::string str = data.serialize();
+		size_t offset = 0;
+		do
+		{
+			while (isFull())
+			{
+				std::this_thread::yield();
+			}
+			size_t length = std::min(header->slot_size, str.length() - offset);
+			writeSlot(str.c_str() + offset, length, offset + length < str.length());
+			offset += length;
+			events.notifyPeer();
+		} while (offset < str.length());
+	}
+
+	// клиент отключён за то, что не читал ответы
+	bool isClosed() const
+	{
+		return closed;
+	}
+
+	bool hasOutbound() const
+	{
+		return has_outbound;
+	}
+
+	// дописывает накопленное; зовётся, пока hasOutbound
+	void flush() const
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		flushOutbound();
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_RING_CONNECTION_H
@@ -3,10 +3,11 @@
 
 
 #include <string>
-#include <sstream>
-#include <boost/archive/text_oarchive.hpp>
+#include <string_view>
+#include <cstring>
 #include "../extensions/serializable.h"
 #include "../extensions/hashable.h"
+#include "./wire_format.h"
 
 
 template<typename T>
@@ -27,6 +28,7 @@ public:
 		DELETE_DATABASE = 14,
 		DELETE_SCHEMA = 15,
 		DELETE_TABLE = 16,
+		BATCH = 17, // операции над записями одной таблицы, см. Batch
 	};
 
 private:
@@ -41,6 +43,65 @@ public:
 
 	static inline const std::string NULL_DATA = "null";
 
+	// | код запроса (1 байт) | varint длина + база | ... + схема | ... + таблица | ... + данные |
+
+	// запрос, разобранный на месте: все строки указывают в исходный буфер
+	class View
+	{
+	private:
+
+		RequestCode requestCode;
+		std::string_view database;
+		std::string_view schema;
+		std::string_view table;
+		std::string_view data;
+
+		static std::string_view readString(const char*& ptr)
+		{
+			size_t length = WireFormat::readVarint(ptr);
+			std::string_view result(ptr, length);
+			ptr += length;
+			return result;
+		}
+
+	public:
+
+		explicit View(std::string_view serializedRequestObject)
+		{
+			const char* ptr = serializedRequestObject.data();
+			requestCode = static_cast<RequestCode>(static_cast<uint8_t>(*ptr++));
+			database = readString(ptr);
+			schema = readString(ptr);
+			table = readString(ptr);
+			data = readString(ptr);
+		}
+
+		RequestCode getRequestCode() const
+		{
+			return requestCode;
+		}
+
+		std::string_view getDatabase() const
+		{
+			return database;
+		}
+
+		std::string_view getSchema() const
+		{
+			return schema;
+		}
+
+		std::string_view getTable() const
+		{
+			return table;
+		}
+
+		std::string_view getData() const
+		{
+			return data;
+		}
+	};
+
 	RequestObject(RequestCode requestCode, const T& data, const std::string& database,
 			const std::string& schema, const std::string& table)
 			: requestCode(requestCode), data(data.serialize()), database(database), schema(schema), table(table)
@@ -53,48 +114,37 @@ public:
 	{
 	}
 
-	std::string serialize() const override
+	size_t serializedSize() const override
 	{
-		std::stringstream ss;
-		ss << std::string(reinterpret_cast<const char * const>(&requestCode), sizeof(requestCode));
-		size_t tmp = database.length();
-		ss << std::string(reinterpret_cast<char *>(&tmp), sizeof(tmp)) << database;
-		tmp = schema.length();
-		ss << std::string(reinterpret_cast<char *>(&tmp), sizeof(tmp)) << schema;
-		tmp = table.length();
-		ss << std::string(reinterpret_cast<char *>(&tmp), sizeof(tmp)) << table;
-		tmp = data.length();
-		ss << std::string(reinterpret_cast<char *>(&tmp), sizeof(tmp)) << data;
-		return ss.str();
+		size_t size = 1;
+		for (const std::string* str: { &database, &schema, &table, &data })
+			size += WireFormat::varintSize(str->length()) + str->length();
+		return size;
 	}
 
-	static RequestObject deserialize(std::string& serializedRequestObject)
+	void serializeTo(char* buffer) const override
 	{
-		const char* ptr = serializedRequestObject.c_str();
-
-		RequestCode requestCode = *reinterpret_cast<const RequestCode *>(ptr);
-		ptr += sizeof(RequestCode);
-
-		size_t databaseLength = *reinterpret_cast<const size_t *>(ptr);
-		ptr += sizeof(size_t);
-		std::string database(ptr, databaseLength);
-		ptr += databaseLength;
-
-		size_t schemaLength = *reinterpret_cast<const size_t *>(ptr);
-		ptr += sizeof(size_t);
-		std::string schema(ptr, schemaLength);
-		ptr += schemaLength;
-
-		size_t tableLength = *reinterpret_cast<const size_t *>(ptr);
-		ptr += sizeof(size_t);
-		std::string table(ptr, tableLength);
-		ptr += tableLength;
+		*buffer++ = static_cast<char>(requestCode);
+		for (const std::string* str: { &database, &schema, &table, &data })
+		{
+			buffer = WireFormat::writeVarint(buffer, str->length());
+			memcpy(buffer, str->c_str(), str->length());
+			buffer += str->length();
+		}
+	}
 
-		size_t dataLength = *reinterpret_cast<const size_t *>(ptr);
-		ptr += sizeof(size_t);
-		std::string data(ptr, dataLength);
+	std::string serialize() const override
+	{
+		std::string result(serializedSize(), '\0');
+		serializeTo(&result[0]);
+		return result;
+	}
 
-		return { requestCode, data, database, schema, table };
+	static RequestObject deserialize(const std::string& serializedRequestObject)
+	{
+		View view(serializedRequestObject);
+		return { view.getRequestCode(), std::string(view.getData()), std::string(view.getDatabase()),
+				 std::string(view.getSchema()), std::string(view.getTable()) };
 	}
 
 	const RequestCode getRequestCode() const
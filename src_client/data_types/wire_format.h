@@ -0,0 +1,110 @@
+#ifndef PROGC_SRC_DATA_TYPES_WIRE_FORMAT_H
+#define PROGC_SRC_DATA_TYPES_WIRE_FORMAT_H
+
+
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+#include <string_view>
+#include <boost/crc.hpp>
+
+
+/*
+ Примитивы двоичного формата кадров, без iostream.
+ varint (LEB128): число пишется по 7 бит, младшие вперёд, старший бит байта - "дальше есть ещё байт".
+ Поэтому короткие строки и небольшие номера запросов занимают 1-2 байта вместо 8.
+ Многобайтовые поля фиксированной длины пишутся младшим байтом вперёд, чтобы кадр
+ одинаково читался на любой машине.
+ */
+
+
+class WireFormat
+{
+public:
+
+	static inline const size_t MAX_VARINT_SIZE = 10;
+	static inline const size_t CHECKSUM_SIZE = sizeof(uint32_t);
+
+	static size_t varintSize(uint64_t value)
+	{
+		size_t size = 1;
+		while (value >= 0x80)
+		{
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	// возвращает позицию сразу за записанным числом
+	static char* writeVarint(char* buffer, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			*buffer++ = static_cast<char>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		*buffer++ = static_cast<char>(value);
+		return buffer;
+	}
+
+	// ptr сдвигается за прочитанное число
+	static uint64_t readVarint(const char*& ptr)
+	{
+		uint64_t value = 0;
+		for (size_t i = 0; i < MAX_VARINT_SIZE; i++)
+		{
+			auto byte = static_cast<uint8_t>(*ptr++);
+			value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+			if (!(byte & 0x80))
+				return value;
+		}
+		throw std::runtime_error("Malformed varint");
+	}
+
+	// как readVarint, но не заходит за end (данные пришли от чужого процесса); false - числа там нет
+	static bool readVarint(const char*& ptr, const char* end, uint64_t& value)
+	{
+		value = 0;
+		for (size_t i = 0; i < MAX_VARINT_SIZE && ptr < end; i++)
+		{
+			auto byte = static_cast<uint8_t>(*ptr++);
+			value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	static void writeUint32(char* buffer, uint32_t value)
+	{
+		for (size_t i = 0; i < sizeof(value); i++)
+			buffer[i] = static_cast<char>(value >> (8 * i));
+	}
+
+	static uint32_t readUint32(const char* buffer)
+	{
+		uint32_t value = 0;
+		for (size_t i = 0; i < sizeof(value); i++)
+			value |= static_cast<uint32_t>(static_cast<uint8_t>(buffer[i])) << (8 * i);
+		return value;
+	}
+
+	static uint32_t checksum(const char* data, size_t length)
+	{
+		return checksum({ { data, length } });
+	}
+
+	// одна сумма по нескольким кускам подряд
+	static uint32_t checksum(std::initializer_list<std::string_view> parts)
+	{
+		boost::crc_32_type crc;
+		for (std::string_view part: parts)
+			crc.process_bytes(part.data(), part.size());
+		return crc.checksum();
+	}
+};
+
+
+#endif //PROGC_SRC_DATA_TYPES_WIRE_FORMAT_H
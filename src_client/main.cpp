@@ -3,17 +3,18 @@
 
 
 const std::string CON_MEM_NAME = "con_mem";
-const std::string CON_MUTEX_NAME = "con_mutex";
 const int CLIENT_STATUS_CODE = 2;
 const int LOG_SERVER_STATUS_CODE = 4;
 const std::string LOG_MEM_NAME = "log_mem";
-const std::string LOG_MUTEX_NAME = "log_mutex";
+const size_t SPIN_COUNT = WaitStrategy::DEFAULT_SPIN_COUNT;
+const size_t YIELD_COUNT = WaitStrategy::DEFAULT_YIELD_COUNT;
 
 
 int main()
 {
-	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME, LOG_MUTEX_NAME);
-	ClientProcessor clientProcessor(CLIENT_STATUS_CODE, CON_MEM_NAME, CON_MUTEX_NAME, serverLogger);
+	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME);
+	ClientProcessor clientProcessor(CLIENT_STATUS_CODE, CON_MEM_NAME, serverLogger,
+			WaitStrategy(SPIN_COUNT, YIELD_COUNT));
 	clientProcessor.interactiveMenu();
 
 	return 0;
@@ -0,0 +1,68 @@
+#ifndef PROGC_SRC_BENCHMARKS_KEY_DISTRIBUTION_REPORT_H
+#define PROGC_SRC_BENCHMARKS_KEY_DISTRIBUTION_REPORT_H
+
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../collections/consistent_hash_ring.h"
+#include "../data_types/contest_info.h"
+
+
+/*
+ Как ключи (candidate id, contest id) распределяются по хранилищам на кольце
+ и какая доля ключей переезжает при подключении ещё одного хранилища - по кольцу и по остатку от деления.
+ */
+
+
+class KeyDistributionReport
+{
+public:
+
+	static std::string run(size_t storageCount, size_t virtualNodes, size_t keyCount)
+	{
+		storageCount = std::max<size_t>(storageCount, 1);
+		virtualNodes = std::max<size_t>(virtualNodes, 1);
+		std::vector<uint64_t> keys;
+		keys.reserve(keyCount);
+		for (size_t i = 0; i < keyCount; i++)
+		{
+			keys.push_back(ContestInfo::get_obj_for_search(1000 + static_cast<int>(i % 9000),
+					1000 + static_cast<int>(i / 9000)).hashcode());
+		}
+
+		ConsistentHashRing ring(storageCount, virtualNodes);
+		ConsistentHashRing grown(storageCount + 1, virtualNodes);
+		std::vector<size_t> counts(storageCount);
+		size_t movedRing = 0, movedModulo = 0;
+		for (uint64_t key: keys)
+		{
+			size_t node = ring.nodeFor(key);
+			counts[node]++;
+			movedRing += grown.nodeFor(key) != node;
+			movedModulo += key % (storageCount + 1) != key % storageCount;
+		}
+
+		auto percent = [&](size_t count)
+		{ return keys.empty() ? 0.0 : 100.0 * static_cast<double>(count) / static_cast<double>(keys.size()); };
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1);
+		ss << keys.size() << " keys on " << storageCount << " storages, " << virtualNodes << " virtual nodes each:"
+		   << std::endl;
+		for (size_t node = 0; node < storageCount; node++)
+		{
+			ss << "storage" << node << ": " << counts[node] << " (" << percent(counts[node]) << "%)" << std::endl;
+		}
+		auto [least, most] = std::minmax_element(counts.begin(), counts.end());
+		ss << "max / min: " << *most << " / " << *least << std::endl;
+		ss << "moved when storage" << storageCount << " joins: ring " << percent(movedRing) << "%, modulo "
+		   << percent(movedModulo) << "% (ideal " << 100.0 / static_cast<double>(storageCount + 1) << "%)"
+		   << std::endl;
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_BENCHMARKS_KEY_DISTRIBUTION_REPORT_H
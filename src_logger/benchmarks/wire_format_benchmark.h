@@ -0,0 +1,153 @@
+#ifndef PROGC_SRC_BENCHMARKS_WIRE_FORMAT_BENCHMARK_H
+#define PROGC_SRC_BENCHMARKS_WIRE_FORMAT_BENCHMARK_H
+
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include "../data_types/shared_object.h"
+#include "../data_types/request_object.h"
+#include "../data_types/contest_info.h"
+
+
+/*
+ Замер "закодировать запрос в кадр и разобрать обратно" для прежней кодировки
+ (std::stringstream, длины как size_t) и для двоичного кадра с varint-длинами.
+ Данные (сериализованный ContestInfo) одинаковые, поэтому разница - только в кадрировании.
+ И пересылка кадра с контрольной суммой под другим номером, как делает сервер: сквозная (сумма копируется)
+ и со сборкой кадра заново (сумма пересчитывается), для маленьких и больших данных.
+ */
+
+
+class WireFormatBenchmark
+{
+private:
+
+	// прежняя кодировка RequestObject
+	static std::string legacyEncodeRequest(int requestCode, const std::string& data, const std::string& database,
+			const std::string& schema, const std::string& table)
+	{
+		std::stringstream ss;
+		ss << std::string(reinterpret_cast<const char*>(&requestCode), sizeof(requestCode));
+		for (const std::string* str: { &database, &schema, &table, &data })
+		{
+			size_t length = str->length();
+			ss << std::string(reinterpret_cast<const char*>(&length), sizeof(length)) << *str;
+		}
+		return ss.str();
+	}
+
+	// прежняя кодировка SharedObject (без удвоения данных, которое уже исправлено)
+	static std::string legacyEncodeFrame(char statusCode, char requestResponseCode, const std::string& data)
+	{
+		std::stringstream ss;
+		ss << statusCode << requestResponseCode;
+		size_t length = data.length();
+		ss << std::string(reinterpret_cast<const char*>(&length), sizeof(length)) << data;
+		return ss.str();
+	}
+
+	static std::string legacyReadString(const char*& ptr)
+	{
+		size_t length = *reinterpret_cast<const size_t*>(ptr);
+		ptr += sizeof(size_t);
+		std::string result(ptr, length);
+		ptr += length;
+		return result;
+	}
+
+	// разбор с копированием строк, как делали прежние deserialize
+	static size_t legacyDecode(const std::string& frame)
+	{
+		const char* ptr = frame.c_str() + 2;
+		std::string request = legacyReadString(ptr);
+		ptr = request.c_str() + sizeof(int);
+		size_t total = 0;
+		for (int i = 0; i < 4; i++)
+			total += legacyReadString(ptr).length();
+		return total;
+	}
+
+	template<typename Body>
+	static double nanosecondsPerOperation(size_t iterations, Body body)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			body();
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / static_cast<double>(iterations);
+	}
+
+public:
+
+	static std::string run(size_t iterations)
+	{
+		const std::string database = "database", schema = "schema", table = "table";
+		const std::string data = ContestInfo(1001, "Smith", "John", "Lee", "1990-01-01", "resume_link", 1, 2001,
+				"C++", 10, 5, false).serialize();
+		const RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::ADD, data, database,
+				schema, table);
+		size_t sink = 0;
+		size_t legacySize = 0, binarySize = 0, checksumSize = 0;
+
+		double legacy = nanosecondsPerOperation(iterations, [&]
+		{
+			std::string frame = legacyEncodeFrame(2, SharedObject::RequestResponseCode::REQUEST,
+					legacyEncodeRequest(RequestObject<ContestInfo>::RequestCode::ADD, data, database, schema, table));
+			legacySize = frame.length();
+			sink += legacyDecode(frame);
+		});
+
+		auto binaryRoundTrip = [&](bool checksum, size_t& size)
+		{
+			std::string frame = SharedObject::Frame(2, SharedObject::RequestResponseCode::REQUEST, request, 1)
+					.withChecksum(checksum).serialize();
+			size = frame.length();
+			SharedObject::View view(frame.c_str(), frame.length());
+			RequestObject<ContestInfo>::View decoded(view.getRawData());
+			sink += decoded.getDatabase().length() + decoded.getSchema().length() + decoded.getTable().length()
+					+ decoded.getData().length();
+		};
+		double binary = nanosecondsPerOperation(iterations, [&]
+		{ binaryRoundTrip(false, binarySize); });
+		double binaryChecksum = nanosecondsPerOperation(iterations, [&]
+		{ binaryRoundTrip(true, checksumSize); });
+
+		std::string relayBuffer;
+		auto relayTime = [&](size_t dataLength, bool cutThrough)
+		{
+			std::string frame = SharedObject::Frame(2, SharedObject::RequestResponseCode::REQUEST,
+					std::string(dataLength, 'x'), 1).withChecksum().serialize();
+			return nanosecondsPerOperation(iterations, [&]
+			{
+				SharedObject::View view(frame.c_str(), frame.length(), false);
+				auto relay = [&](const SharedObject::Frame& relayed)
+				{
+					relayBuffer.resize(relayed.serializedSize());
+					relayed.serializeTo(&relayBuffer[0]);
+					sink += relayBuffer.length();
+				};
+				if (cutThrough)
+					relay(SharedObject::Frame(3, view, 7));
+				else
+					relay(SharedObject::Frame(3, view.getRequestResponseCode(), view.getRawData(), 7).withChecksum());
+			});
+		};
+
+		std::stringstream ss;
+		ss << "Round trip of " << iterations << " requests (" << sink / (3 * iterations) << " bytes of strings):"
+		   << std::endl
+		   << "stringstream:       " << legacy << " ns, frame " << legacySize << " bytes" << std::endl
+		   << "binary:             " << binary << " ns, frame " << binarySize << " bytes" << std::endl
+		   << "binary + checksum:  " << binaryChecksum << " ns, frame " << checksumSize << " bytes" << std::endl;
+		for (size_t dataLength: { size_t(100), size_t(64 * 1024) })
+		{
+			ss << "relay of " << dataLength << " bytes with checksum: cut-through " << relayTime(dataLength, true)
+			   << " ns, rebuilt " << relayTime(dataLength, false) << " ns" << std::endl;
+		}
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_BENCHMARKS_WIRE_FORMAT_BENCHMARK_H
@@ -1331,6 +1331,49 @@ public:
 		}
 	};
 
+	// не больше limit пар с ключами больше after (nullptr - с начала): по ним дерево обходится частями,
+	// и между частями его можно менять
+	std::vector<typename Map<K, V>::Pair> entriesAfter(const K* after, size_t limit)
+	{
+		std::vector<typename Map<K, V>::Pair> list;
+		if (size_ == 0)
+			return std::move(list);
+		Node* current = root;
+		int index = 0;
+		if (after == nullptr)
+		{
+			while (!current->isLeaf())
+				current = current->children[0];
+		}
+		else
+		{
+			Entry* data = createEntry(*after);
+			while (!current->isLeaf())
+			{
+				bool isFound = current->entries->binarySearch(index, data);
+				current = current->children[isFound ? index + 1 : index];
+			}
+			if (current->entries->binarySearch(index, data))
+				index++;
+			destroyEntry(data);
+		}
+		while (list.size() < limit)
+		{
+			if (index >= current->entries->getSize())
+			{
+				if (current->right == nullptr)
+					break;
+				current = current->right;
+				index = 0;
+				continue;
+			}
+			Entry* entry = current->entries->get(index);
+			list.emplace_back(entry->key, entry->value);
+			index++;
+		}
+		return std::move(list);
+	}
+
 	typename BPlusTreeMap<K, V>::BPlusTreeMapIterator begin()
 	{
 		return std::move(BPlusTreeMapIterator(true, *this));
@@ -0,0 +1,140 @@
+#ifndef PROGC_SRC_CONCURRENCY_SHARED_EVENT_H
+#define PROGC_SRC_CONCURRENCY_SHARED_EVENT_H
+
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+
+using namespace boost::interprocess;
+
+
+/*
+ Счётчик событий в разделяемой памяти ("дверной звонок" процесса).
+ Владелец ждёт, пока счётчик не изменится; любой другой процесс может позвонить через notify.
+ Мьютекс и условная переменная трогаются только если кто-то действительно спит.
+ */
+
+
+class SharedEvent
+{
+public:
+
+	static inline const std::chrono::milliseconds IDLE_TIMEOUT = std::chrono::seconds(1);
+
+private:
+
+	struct State
+	{
+		interprocess_mutex mutex;
+		interprocess_condition condition;
+		std::atomic<uint32_t> sequence;
+		std::atomic<uint32_t> waiters;
+	};
+
+	mapped_region* mreg;
+	State* state;
+	const bool is_owner;
+	std::string name;
+
+public:
+
+	SharedEvent(bool isOwner, const std::string& eventName) : is_owner(isOwner), name(eventName)
+	{
+		if (is_owner)
+		{
+			try
+			{ shared_memory_object::remove(name.c_str()); }
+			catch (...)
+			{}
+			shared_memory_object shm(create_only, name.c_str(), read_write);
+			shm.truncate(sizeof(State));
+			mreg = new mapped_region(shm, read_write);
+			state = new(mreg->get_address()) State();
+			state->sequence.store(0);
+			state->waiters.store(0);
+		}
+		else
+		{
+			shared_memory_object shm(open_only, name.c_str(), read_write);
+			mreg = new mapped_region(shm, read_write);
+			state = static_cast<State*>(mreg->get_address());
+		}
+	}
+
+	~SharedEvent()
+	{
+		if (is_owner)
+		{
+			shared_memory_object::remove(name.c_str());
+		}
+		delete mreg;
+	}
+
+	const std::string& getName() const
+	{
+		return name;
+	}
+
+	uint32_t sequence() const
+	{
+		return state->sequence.load();
+	}
+
+	void notify() const
+	{
+		state->sequence.fetch_add(1);
+		if (state->waiters.load() > 0)
+		{
+			scoped_lock<interprocess_mutex> lock(state->mutex);
+			state->condition.notify_all();
+		}
+	}
+
+	// ждёт, пока счётчик отличается от seen; false - вышел таймаут
+	bool wait(uint32_t seen, std::chrono::milliseconds timeout = IDLE_TIMEOUT) const
+	{
+		boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time()
+											+ boost::posix_time::milliseconds(timeout.count());
+		scoped_lock<interprocess_mutex> lock(state->mutex);
+		state->waiters.fetch_add(1);
+		bool notified = true;
+		while (state->sequence.load() == seen)
+		{
+			if (!state->condition.timed_wait(lock, deadline))
+			{
+				notified = state->sequence.load() != seen;
+				break;
+			}
+		}
+		state->waiters.fetch_sub(1);
+		return notified;
+	}
+
+	// ждёт, пока ready() не вернёт true; звонок, пришедший между проверкой и сном, не теряется
+	template<typename Predicate>
+	void waitFor(Predicate ready, std::chrono::milliseconds timeout = IDLE_TIMEOUT) const
+	{
+		while (true)
+		{
+			uint32_t seen = sequence();
+			if (ready())
+				return;
+			wait(seen, timeout);
+		}
+	}
+
+	SharedEvent(const SharedEvent&) = delete;
+
+	SharedEvent& operator=(const SharedEvent&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONCURRENCY_SHARED_EVENT_H
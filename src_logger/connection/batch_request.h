@@ -0,0 +1,112 @@
+#ifndef PROGC_SRC_CONNECTION_BATCH_REQUEST_H
+#define PROGC_SRC_CONNECTION_BATCH_REQUEST_H
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "./pending_request.h"
+#include "../data_types/batch.h"
+
+
+// пачка операций клиента, разделённая между хранилищами; клиенту отвечают после ответа на последнюю часть,
+// результаты - в порядке операций. Части отвечают из разных потоков
+class BatchRequest : public PendingRequest
+{
+private:
+
+	const uint64_t correlation_id;
+	std::atomic<int> waitResponseCount;
+	std::mutex results_mutex;
+	std::vector<Batch::Result> results;
+
+public:
+
+	BatchRequest(std::shared_ptr<Connection> connection, uint64_t correlationId, size_t operationCount,
+			int waitResponseCount)
+			: PendingRequest(std::move(connection), std::string()), correlation_id(correlationId),
+			  waitResponseCount(waitResponseCount), results(operationCount)
+	{
+		if (waitResponseCount < 1)
+			throw std::runtime_error("Response count must be > 0");
+	}
+
+	// ответ хранилища на часть с операциями positions; returns is the required number of responses received
+	bool getResponse(const std::vector<size_t>& positions, int code, std::string_view data)
+	{
+		{
+			std::lock_guard<std::mutex> lock(results_mutex);
+			std::vector<Batch::Result> part;
+			if (code == SharedObject::RequestResponseCode::OK)
+				part = Batch::decodeResults(data);
+			// без ответа на каждую операцию результаты части не сопоставить, все её операции - ERROR
+			if (part.size() == positions.size())
+			{
+				for (size_t i = 0; i < positions.size(); i++)
+					results[positions[i]] = std::move(part[i]);
+			}
+		}
+		return --waitResponseCount < 1;
+	}
+
+	// клиенту - с его собственным номером запроса
+	void reply(int statusCode)
+	{
+		std::lock_guard<std::mutex> lock(results_mutex);
+		sendMessage(SharedObject::Frame(statusCode, SharedObject::RequestResponseCode::OK,
+				Batch::encodeResults(results), correlation_id));
+	}
+
+	void replyTimeout(int statusCode) override
+	{
+		sendMessage(SharedObject::Frame(statusCode, SharedObject::RequestResponseCode::TIMEOUT,
+				SharedObject::NULL_DATA, correlation_id));
+	}
+};
+
+
+// часть пачки для одного хранилища (или реплик одного ключа): сама пачка в том же формате
+class BatchPart : public PendingRequest
+{
+private:
+
+	const std::shared_ptr<BatchRequest> batch;
+	const std::vector<size_t> positions; // номера операций в пачке клиента
+	const std::vector<std::string> written_keys; // ключи кэша чтений, которые часть пишет
+	const bool read_only;
+
+public:
+
+	BatchPart(std::shared_ptr<BatchRequest> batch, std::string message, std::vector<size_t> positions,
+			std::vector<std::string> writtenKeys, bool readOnly)
+			: PendingRequest(batch->getConnection(), std::move(message)), batch(std::move(batch)),
+			  positions(std::move(positions)), written_keys(std::move(writtenKeys)), read_only(readOnly)
+	{
+		deadline = this->batch->getDeadline();
+	}
+
+	const std::shared_ptr<BatchRequest>& getBatch() const
+	{
+		return batch;
+	}
+
+	const std::vector<size_t>& getPositions() const
+	{
+		return positions;
+	}
+
+	const std::vector<std::string>& getWrittenKeys() const
+	{
+		return written_keys;
+	}
+
+	// только чтения: часть, как и одиночное чтение, уходит одной реплике
+	bool isReadOnly() const
+	{
+		return read_only;
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_BATCH_REQUEST_H
@@ -0,0 +1,78 @@
+#ifndef PROGC_SRC_CONNECTION_MIGRATION_REQUEST_H
+#define PROGC_SRC_CONNECTION_MIGRATION_REQUEST_H
+
+
+#include "./pending_request.h"
+#include "../data_types/shared_object.h"
+
+
+// шаг переноса диапазона: забрать пачку у старого владельца (OUT), отдать её новым (IN),
+// разрешить старому удалить её (COMMIT) или вернуть ему на повтор (ABORT)
+// отвечать некому, ответ хранилища разбирает сам сервер
+class MigrationRequest : public PendingRequest
+{
+public:
+
+	enum Stage
+	{
+		OUT,
+		IN,
+		COMMIT,
+		ABORT,
+	};
+
+private:
+
+	const Stage stage;
+	const size_t range;
+	const uint64_t attempt; // ответы на шаги прерванной попытки переноса не нужны
+	const bool last; // для IN и COMMIT - пачка последняя в диапазоне
+
+	static SharedObject::RequestResponseCode codeFor(Stage stage)
+	{
+		switch (stage)
+		{
+		case OUT:
+			return SharedObject::RequestResponseCode::MIGRATE_OUT;
+		case IN:
+			return SharedObject::RequestResponseCode::MIGRATE_IN;
+		case COMMIT:
+			return SharedObject::RequestResponseCode::MIGRATE_COMMIT;
+		default:
+			return SharedObject::RequestResponseCode::MIGRATE_ABORT;
+		}
+	}
+
+public:
+
+	MigrationRequest(int statusCode, Stage stage, size_t range, uint64_t attempt, std::string_view data,
+			bool last = false)
+			: PendingRequest(nullptr, SharedObject::Frame(statusCode, codeFor(stage), data).serialize()),
+			  stage(stage), range(range), attempt(attempt), last(last)
+	{
+		Connection::connectionName = "migration";
+	}
+
+	Stage getStage() const
+	{
+		return stage;
+	}
+
+	size_t getRange() const
+	{
+		return range;
+	}
+
+	uint64_t getAttempt() const
+	{
+		return attempt;
+	}
+
+	bool isLast() const
+	{
+		return last;
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_MIGRATION_REQUEST_H
@@ -0,0 +1,114 @@
+#ifndef PROGC_SRC_CONNECTION_PENDING_REQUEST_H
+#define PROGC_SRC_CONNECTION_PENDING_REQUEST_H
+
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include "./connection.h"
+#include "../data_types/shared_object.h"
+
+
+// запрос клиента, ожидающий хранилища; кадр скопирован, чтобы клиент мог слать следующие запросы
+// контрольную сумму кадра сервер проверил при приёме, у копии её уже не проверяют
+class PendingRequest : public Connection
+{
+protected:
+
+	std::shared_ptr<Connection> connection;
+	const std::string message;
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+	std::atomic<bool> finished{ false }; // клиенту ответили: ответом хранилища или TIMEOUT
+
+public:
+
+	explicit PendingRequest(std::shared_ptr<Connection> connection)
+			: connection(std::move(connection)),
+			  message(this->connection->receiveMessage(), SharedObject::View(this->connection->receiveMessage(),
+					  this->connection->receiveSize(), false).size())
+	{
+		Connection::connectionName = this->connection->getName();
+	}
+
+	// запрос, который сервер шлёт хранилищу от своего имени; connection может быть nullptr
+	PendingRequest(std::shared_ptr<Connection> connection, std::string message)
+			: connection(std::move(connection)), message(std::move(message))
+	{
+		if (this->connection)
+			Connection::connectionName = this->connection->getName();
+	}
+
+	std::shared_ptr<Connection> getConnection()
+	{
+		return connection;
+	}
+
+	uint64_t getCorrelationId() const
+	{
+		return SharedObject::View(receiveMessage(), receiveSize(), false).getCorrelationId();
+	}
+
+	std::chrono::steady_clock::time_point getDeadline() const
+	{
+		return deadline;
+	}
+
+	// задаётся до того, как запрос отдан хранилищам
+	void setDeadline(std::chrono::steady_clock::time_point newDeadline)
+	{
+		deadline = newDeadline;
+	}
+
+	bool isExpired(std::chrono::steady_clock::time_point now) const
+	{
+		return now >= deadline;
+	}
+
+	// сколько осталось до срока; nullopt - срока нет
+	std::optional<std::chrono::milliseconds> getRemaining(std::chrono::steady_clock::time_point now) const
+	{
+		if (deadline == std::chrono::steady_clock::time_point::max())
+			return std::nullopt;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+	}
+
+	// true - ответ клиенту ещё не отправлен и теперь его отправляет вызвавший; ответ и TIMEOUT идут из разных потоков
+	bool finish()
+	{
+		return !finished.exchange(true);
+	}
+
+	// клиенту - что срок истёк, с его номером запроса; вызывается после finish()
+	virtual void replyTimeout(int statusCode)
+	{
+		sendMessage(SharedObject::Frame(statusCode, SharedObject::RequestResponseCode::TIMEOUT,
+				SharedObject::NULL_DATA, getCorrelationId()));
+	}
+
+	const char* receiveMessage() const override
+	{
+		return message.c_str();
+	}
+
+	size_t receiveSize() const override
+	{
+		return message.length();
+	}
+
+	void sendMessage(const Serializable& response) const override
+	{
+		return connection->sendMessage(response);
+	}
+
+	PendingRequest(const PendingRequest&) = delete;
+
+	PendingRequest& operator=(const PendingRequest&) = delete;
+
+	PendingRequest(PendingRequest&&) = delete;
+
+	PendingRequest& operator=(PendingRequest&&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONNECTION_PENDING_REQUEST_H
@@ -0,0 +1,87 @@
+#ifndef PROGC_SRC_CONNECTION_REPLICATED_REQUEST_H
+#define PROGC_SRC_CONNECTION_REPLICATED_REQUEST_H
+
+
+#include <atomic>
+#include <mutex>
+#include "./pending_request.h"
+
+
+// запись, разосланная всем репликам ключа; клиенту отвечают после ответа последней
+// ответ - первый успешный (реплики хранят одно и то же), иначе первый пришедший
+// ответы реплик приходят из разных потоков
+class ReplicatedRequest : public PendingRequest
+{
+private:
+
+	const std::shared_ptr<PendingRequest> origin; // запрос, разосланный репликам; кадр берётся у него
+
+	std::atomic<int> waitResponseCount;
+	std::mutex response_mutex;
+	bool has_response = false;
+	int response_code = SharedObject::RequestResponseCode::ERROR;
+	std::string response_data = SharedObject::NULL_DATA;
+
+public:
+
+	ReplicatedRequest(const std::shared_ptr<PendingRequest>& request, int waitResponseCount)
+			: PendingRequest(request->getConnection(), std::string()), origin(request),
+			  waitResponseCount(waitResponseCount)
+	{
+		if (waitResponseCount < 1)
+			throw std::runtime_error("Response count must be > 0");
+	}
+
+	const std::shared_ptr<PendingRequest>& getOrigin() const
+	{
+		return origin;
+	}
+
+	const char* receiveMessage() const override
+	{
+		return origin->receiveMessage();
+	}
+
+	size_t receiveSize() const override
+	{
+		return origin->receiveSize();
+	}
+
+	// returns is the required number of responses received
+	bool getResponse(const SharedObject::View& message)
+	{
+		{
+			std::lock_guard<std::mutex> lock(response_mutex);
+			if (!has_response || (response_code != SharedObject::RequestResponseCode::OK
+								  && message.getRequestResponseCode() == SharedObject::RequestResponseCode::OK))
+			{
+				response_code = message.getRequestResponseCode();
+				response_data = message.getRawData();
+				has_response = true;
+			}
+		}
+		return --waitResponseCount < 1;
+	}
+
+	int getResponseCode()
+	{
+		std::lock_guard<std::mutex> lock(response_mutex);
+		return response_code;
+	}
+
+	std::string getResponseData()
+	{
+		std::lock_guard<std::mutex> lock(response_mutex);
+		return response_data;
+	}
+
+	// клиенту - с его собственным номером запроса
+	void reply(int statusCode)
+	{
+		std::lock_guard<std::mutex> lock(response_mutex);
+		sendMessage(SharedObject::Frame(statusCode, response_code, response_data, getCorrelationId()));
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_REPLICATED_REQUEST_H
@@ -2,6 +2,7 @@
 #define PROGC_SRC_DATA_TYPES_CONTEST_INFO_H
 
 
+#include <cstdint>
 #include <string>
 #include "../extensions/hashable.h"
 #include "../extensions/serializable.h"
@@ -74,11 +75,11 @@ public:
 		return {candidate_id, null, null, null, null, null, 0, contest_id, null, 0, 0, false};
 	}
 
+	// оба id целиком, без совпадений у разных пар; по кольцу хранилищ ключи разбрасывает ConsistentHashRing::mix
 	size_t hashcode() const override
 	{
-		size_t h1 = std::hash<int>()(candidate_id);
-		size_t h2 = std::hash<int>()(contest_id);
-		return h1 ^ (h2 << 1);
+		return (static_cast<uint64_t>(static_cast<uint32_t>(candidate_id)) << 32)
+			   | static_cast<uint32_t>(contest_id);
 	}
 
 	bool operator==(const ContestInfo& other) const
@@ -2,10 +2,15 @@
 #define PROGC_SRC_DATA_TYPES_SHARED_OBJECT_H
 
 
+#include <chrono>
 #include <sstream>
 #include <utility>
 #include <optional>
+#include <string_view>
+#include <cstring>
+#include <stdexcept>
 #include "../extensions/serializable.h"
+#include "./wire_format.h"
 
 
 /*
@@ -30,19 +35,309 @@ public:
 		CLOSE_CONNECTION = 15,
 		OK = 20,
 		ERROR = 21,
+		RETRY_LATER = 22, // очередь хранилища полна, запрос надо повторить позже
+		TIMEOUT = 23, // срок запроса истёк, выполнен ли он - неизвестно
 		STORAGE_REBALANCE = 30,
+		MIGRATE_OUT = 31, // отдать пачку записей переезжающего диапазона, записи остаются до MIGRATE_COMMIT
+		MIGRATE_IN = 32, // принять пачку записей
+		PACKED = 33, // несколько кадров сервер -> хранилище в одном (data_types/frame_pack.h), ответ - так же
+		MIGRATE_COMMIT = 34, // пачку приняли все новые владельцы, старый может удалить отданные записи
+		MIGRATE_ABORT = 35, // пачка не перенесена, отданные записи снова ждут переноса
 	};
 
 private:
 
 	char status_code; // первый байт - обработались ли данные
 	char request_response_code; // код запроса / ответа
+	uint64_t correlation_id = 0; // номер запроса у клиента, ответ несёт тот же номер
+	uint64_t routing_key = 0; // ключ, по которому выбирается хранилище; 0 - не задан
+	bool checksum = false;
 	const std::string data; // "null" - NULL
 
 public:
 
 	static inline const std::string NULL_DATA = "null";
 
+	/*
+	 Кадр:
+	 | статус | MAGIC | VERSION | флаги | код запроса / ответа |
+	 | varint correlation id | varint срок в мс, если FLAG_DEADLINE | varint ключ маршрутизации |
+	 | varint длина данных | данные | crc32, если FLAG_CHECKSUM |
+	 Статус остаётся первым байтом: по нему соединения понимают, чей кадр лежит в памяти.
+	 При пересылке сервер переписывает статус, correlation id и срок, поэтому контрольная сумма их не покрывает
+	 и пересылаемый кадр копируется вместе с ней, без пересчёта по всем данным.
+	 Срок - сколько мс осталось до него у отправителя: часы разных машин не сравнить, а интервал переносится.
+	 */
+	static inline const char MAGIC = 0x5C;
+	static inline const char VERSION = 2;
+	static inline const uint8_t FLAG_CHECKSUM = 1;
+	static inline const uint8_t FLAG_DEADLINE = 2;
+	static inline const size_t FIXED_HEADER_SIZE = 5;
+	static inline const size_t MAX_HEADER_SIZE = FIXED_HEADER_SIZE + 4 * WireFormat::MAX_VARINT_SIZE;
+
+	static size_t headerSize(uint64_t correlationId, uint64_t timeout, uint64_t routingKey, size_t dataLength,
+			uint8_t flags)
+	{
+		return FIXED_HEADER_SIZE + WireFormat::varintSize(correlationId)
+			   + (flags & FLAG_DEADLINE ? WireFormat::varintSize(timeout) : 0) + WireFormat::varintSize(routingKey)
+			   + WireFormat::varintSize(dataLength);
+	}
+
+	// возвращает начало данных
+	static char* writeHeader(char* buffer, int statusCode, int requestResponseCode, uint64_t correlationId,
+			uint64_t timeout, uint64_t routingKey, size_t dataLength, uint8_t flags)
+	{
+		buffer[0] = static_cast<char>(statusCode);
+		buffer[1] = MAGIC;
+		buffer[2] = VERSION;
+		buffer[3] = static_cast<char>(flags);
+		buffer[4] = static_cast<char>(requestResponseCode);
+		char* ptr = WireFormat::writeVarint(buffer + FIXED_HEADER_SIZE, correlationId);
+		if (flags & FLAG_DEADLINE)
+			ptr = WireFormat::writeVarint(ptr, timeout);
+		ptr = WireFormat::writeVarint(ptr, routingKey);
+		return WireFormat::writeVarint(ptr, dataLength);
+	}
+
+	// всё, кроме статуса, correlation id и срока (и его флага): магия, версия, флаги, код
+	// и от ключа маршрутизации до конца данных
+	static uint32_t checksumOf(const char* frame, const char* afterDeadline, const char* dataEnd)
+	{
+		char flags = static_cast<char>(frame[3] & ~FLAG_DEADLINE);
+		return WireFormat::checksum({ { frame + 1, 2 }, { &flags, 1 }, { frame + 4, 1 },
+									  { afterDeadline, static_cast<size_t>(dataEnd - afterDeadline) } });
+	}
+
+	// длина кадра по его заголовку, с проверкой границ: кадр из сокета мог прислать кто угодно
+	// nullopt - чужой формат или заголовок, данные и контрольная сумма не помещаются в available байт
+	static std::optional<size_t> frameSize(const char* frame, size_t available)
+	{
+		if (available < FIXED_HEADER_SIZE || frame[1] != MAGIC || frame[2] != VERSION)
+			return std::nullopt;
+		auto flags = static_cast<uint8_t>(frame[3]);
+		const char* ptr = frame + FIXED_HEADER_SIZE;
+		const char* end = frame + available;
+		uint64_t value;
+		uint64_t dataLength;
+		if (!WireFormat::readVarint(ptr, end, value)
+			|| ((flags & FLAG_DEADLINE) && !WireFormat::readVarint(ptr, end, value))
+			|| !WireFormat::readVarint(ptr, end, value) || !WireFormat::readVarint(ptr, end, dataLength))
+			return std::nullopt;
+		size_t checksumSize = flags & FLAG_CHECKSUM ? WireFormat::CHECKSUM_SIZE : 0;
+		if (dataLength > static_cast<size_t>(end - ptr) || checksumSize > static_cast<size_t>(end - ptr) - dataLength)
+			return std::nullopt;
+		return ptr - frame + dataLength + checksumSize;
+	}
+
+	// кадр, разобранный на месте: данные остаются в памяти соединения и живут до popMessage
+	class View
+	{
+	private:
+
+		const char* frame;
+		uint8_t flags;
+		uint64_t correlation_id;
+		uint64_t timeout = 0;
+		uint64_t routing_key;
+		const char* data;
+		size_t data_length;
+
+	public:
+
+		// available - сколько байт у кадра есть (слот, собранный кадр, буфер); заголовок может соврать
+		// verifyChecksum = false - кадр уже проверен при приёме (копия у сервера)
+		View(const char* serializedSharedObject, size_t available, bool verifyChecksum = true)
+				: frame(serializedSharedObject)
+		{
+			if (!frameSize(frame, available))
+				throw std::runtime_error("Malformed frame");
+			// дальше границы уже проверены
+			flags = static_cast<uint8_t>(frame[3]);
+			const char* ptr = frame + FIXED_HEADER_SIZE;
+			correlation_id = WireFormat::readVarint(ptr);
+			if (flags & FLAG_DEADLINE)
+				timeout = WireFormat::readVarint(ptr);
+			const char* afterDeadline = ptr;
+			routing_key = WireFormat::readVarint(ptr);
+			data_length = WireFormat::readVarint(ptr);
+			data = ptr;
+			if (verifyChecksum && hasChecksum() && WireFormat::readUint32(data + data_length)
+												   != checksumOf(frame, afterDeadline, data + data_length))
+				throw std::runtime_error("Frame checksum mismatch");
+		}
+
+		int getStatusCode() const
+		{
+			return frame[0];
+		}
+
+		RequestResponseCode getRequestResponseCode() const
+		{
+			return static_cast<RequestResponseCode>(frame[4]);
+		}
+
+		uint64_t getCorrelationId() const
+		{
+			return correlation_id;
+		}
+
+		uint64_t getRoutingKey() const
+		{
+			return routing_key;
+		}
+
+		// сколько оставалось до срока запроса, когда его отправили; nullopt - срока нет
+		std::optional<std::chrono::milliseconds> getTimeout() const
+		{
+			if (!(flags & FLAG_DEADLINE))
+				return std::nullopt;
+			return std::chrono::milliseconds(timeout);
+		}
+
+		bool hasChecksum() const
+		{
+			return flags & FLAG_CHECKSUM;
+		}
+
+		std::optional<std::string_view> getData() const
+		{
+			std::string_view result = getRawData();
+			if (result == NULL_DATA)
+				return std::nullopt;
+			return result;
+		}
+
+		// данные как есть, "null" не превращается в nullopt
+		std::string_view getRawData() const
+		{
+			return { data, data_length };
+		}
+
+		size_t size() const
+		{
+			return data + data_length - frame + (hasChecksum() ? WireFormat::CHECKSUM_SIZE : 0);
+		}
+
+		std::string getPrint() const
+		{
+			std::stringstream ss;
+			ss << std::endl << "Status code: " << getStatusCode() << std::endl << "ReqRes code: "
+			   << (int)getRequestResponseCode() << std::endl << "Correlation id: " << getCorrelationId() << std::endl
+			   << "Data: " << getRawData() << std::endl;
+			return ss.str();
+		}
+	};
+
+	// кадр, собираемый из частей сразу в памяти соединения, без промежуточных строк
+	class Frame : public Serializable
+	{
+	private:
+
+		const int status_code;
+		const int request_response_code;
+		const uint64_t correlation_id;
+		uint64_t timeout = 0;
+		uint64_t routing_key = 0;
+		uint8_t flags = 0;
+		const Serializable* payload = nullptr;
+		const std::string_view raw_payload;
+		bool relayed_checksum = false; // за raw_payload лежит контрольная сумма пересылаемого кадра, она верна
+
+		size_t payloadSize() const
+		{
+			return payload ? payload->serializedSize() : raw_payload.length();
+		}
+
+	public:
+
+		Frame(int statusCode, int requestResponseCode, const Serializable& payload, uint64_t correlationId = 0)
+				: status_code(statusCode), request_response_code(requestResponseCode), correlation_id(correlationId),
+				  payload(&payload)
+		{
+		}
+
+		// payload должен жить, пока кадр не отправлен
+		Frame(int statusCode, int requestResponseCode, std::string_view payload, uint64_t correlationId = 0)
+				: status_code(statusCode), request_response_code(requestResponseCode), correlation_id(correlationId),
+				  raw_payload(payload)
+		{
+		}
+
+		// пересылка принятого кадра от своего имени: заголовок пишется заново, данные с контрольной суммой
+		// копируются как есть, так что работа не зависит от размера данных, кроме одного memcpy
+		Frame(int statusCode, const View& frame) : Frame(statusCode, frame, frame.getCorrelationId())
+		{
+		}
+
+		// ... под другим номером запроса
+		Frame(int statusCode, const View& frame, uint64_t correlationId)
+				: status_code(statusCode), request_response_code(frame.getRequestResponseCode()),
+				  correlation_id(correlationId), routing_key(frame.getRoutingKey()),
+				  flags(frame.hasChecksum() ? FLAG_CHECKSUM : 0), raw_payload(frame.getRawData()),
+				  relayed_checksum(frame.hasChecksum())
+		{
+			withTimeout(frame.getTimeout());
+		}
+
+		// ключ покрыт контрольной суммой, поэтому у пересылаемого кадра она считается заново
+		Frame& withRoutingKey(uint64_t routingKey)
+		{
+			relayed_checksum = relayed_checksum && routing_key == routingKey;
+			routing_key = routingKey;
+			return *this;
+		}
+
+		// срок не покрыт контрольной суммой, пересылаемый кадр сохраняет её; nullopt - без срока,
+		// истёкший срок уходит как 0
+		Frame& withTimeout(std::optional<std::chrono::milliseconds> remaining)
+		{
+			flags = remaining ? flags | FLAG_DEADLINE : flags & ~FLAG_DEADLINE;
+			timeout = remaining ? std::max<int64_t>(remaining->count(), 0) : 0;
+			return *this;
+		}
+
+		// для соединений, где кадр может испортиться по дороге (TCP между машинами)
+		Frame& withChecksum(bool enabled = true)
+		{
+			flags = enabled ? flags | FLAG_CHECKSUM : flags & ~FLAG_CHECKSUM;
+			return *this;
+		}
+
+		size_t serializedSize() const override
+		{
+			size_t length = payloadSize();
+			return headerSize(correlation_id, timeout, routing_key, length, flags) + length
+				   + (flags & FLAG_CHECKSUM ? WireFormat::CHECKSUM_SIZE : 0);
+		}
+
+		void serializeTo(char* buffer) const override
+		{
+			size_t length = payloadSize();
+			char* data = writeHeader(buffer, status_code, request_response_code, correlation_id, timeout,
+					routing_key, length, flags);
+			if (relayed_checksum && (flags & FLAG_CHECKSUM))
+			{
+				memcpy(data, raw_payload.data(), length + WireFormat::CHECKSUM_SIZE);
+				return;
+			}
+			if (payload)
+				payload->serializeTo(data);
+			else
+				memcpy(data, raw_payload.data(), length);
+			if (flags & FLAG_CHECKSUM)
+				WireFormat::writeUint32(data + length, checksumOf(buffer, buffer + FIXED_HEADER_SIZE
+						+ WireFormat::varintSize(correlation_id)
+						+ (flags & FLAG_DEADLINE ? WireFormat::varintSize(timeout) : 0), data + length));
+		}
+
+		std::string serialize() const override
+		{
+			std::string result(serializedSize(), '\0');
+			serializeTo(&result[0]);
+			return result;
+		}
+	};
+
 	SharedObject(int statusCode, RequestResponseCode requestResponseCode, const Serializable& data)
 			: status_code(static_cast<char>(statusCode)),
 			  request_response_code(static_cast<char>(requestResponseCode)), data(data.serialize())
@@ -56,26 +351,31 @@ public:
 	{
 	}
 
+	size_t serializedSize() const override
+	{
+		return toFrame().serializedSize();
+	}
+
+	void serializeTo(char* buffer) const override
+	{
+		toFrame().serializeTo(buffer);
+	}
+
 	std::string serialize() const override
 	{
-		std::stringstream ss;
-		ss << status_code;
-		ss << request_response_code;
-		size_t tmp = data.length();
-		ss << std::string(reinterpret_cast<char*>(&tmp), sizeof(tmp)) << data;
-		ss << data;
-		return ss.str();
+		std::string result(serializedSize(), '\0');
+		serializeTo(&result[0]);
+		return result;
 	}
 
-	static SharedObject deserialize(const char* serializedSharedObject)
+	static SharedObject deserialize(const char* serializedSharedObject, size_t available)
 	{
-		char status_code = *serializedSharedObject;
-		serializedSharedObject++;
-		char request_response_code = *serializedSharedObject;
-		serializedSharedObject++;
-		size_t dataLen = *reinterpret_cast<const size_t*>(serializedSharedObject);
-		serializedSharedObject += sizeof(size_t);
-		return { status_code, request_response_code, std::string(serializedSharedObject, dataLen) };
+		View view(serializedSharedObject, available);
+		SharedObject result(view.getStatusCode(), view.getRequestResponseCode(), std::string(view.getRawData()));
+		result.setCorrelationId(view.getCorrelationId());
+		result.setRoutingKey(view.getRoutingKey());
+		result.setChecksum(view.hasChecksum());
+		return result;
 	}
 
 	static int getStatusCode(const char* serializedSharedObject)
@@ -105,6 +405,31 @@ public:
 		status_code = static_cast<char>(statusCode);
 	}
 
+	uint64_t getCorrelationId() const
+	{
+		return correlation_id;
+	}
+
+	void setCorrelationId(uint64_t correlationId)
+	{
+		correlation_id = correlationId;
+	}
+
+	uint64_t getRoutingKey() const
+	{
+		return routing_key;
+	}
+
+	void setRoutingKey(uint64_t routingKey)
+	{
+		routing_key = routingKey;
+	}
+
+	void setChecksum(bool enabled)
+	{
+		checksum = enabled;
+	}
+
 	void print()
 	{
 		std::cout << std::endl << "Status code: " << (int)status_code << std::endl << "ReqRes code: "
@@ -118,6 +443,15 @@ public:
 		   << (int)request_response_code << std::endl << "Data: " << data << std::endl;
 		return ss.str();
 	}
+
+private:
+
+	Frame toFrame() const
+	{
+		Frame frame(status_code, request_response_code, std::string_view(data), correlation_id);
+		frame.withRoutingKey(routing_key).withChecksum(checksum);
+		return frame;
+	}
 };
 
 
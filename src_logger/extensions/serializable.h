@@ -4,6 +4,7 @@
 
 
 #include <string>
+#include <cstring>
 
 class Serializable
 {
@@ -11,6 +12,19 @@ public:
 
 	virtual std::string serialize() const = 0;
 
+	// длина результата serialize(); переопределяется, чтобы писать без промежуточной строки
+	virtual size_t serializedSize() const
+	{
+		return serialize().length();
+	}
+
+	// пишет то же, что serialize(), прямо в buffer (serializedSize() байт)
+	virtual void serializeTo(char* buffer) const
+	{
+		std::string str = serialize();
+		memcpy(buffer, str.c_str(), str.length());
+	}
+
 	virtual ~Serializable() = default;
 };
 
@@ -5,17 +5,20 @@
 
 const int LOG_SERVER_STATUS_CODE = 4;
 const std::string LOG_MEM_NAME = "log_mem";
-const std::string LOG_MUTEX_NAME = "log_mutex";
+// логи не ждут ответа, так что задержка не важна - сразу паркуемся
+const size_t SPIN_COUNT = 0;
+const size_t YIELD_COUNT = 0;
 
 
 int main()
 {
 	logger* logger = logger_builder_concrete::file_construct("log_settings.txt");
-	LogServerProcessor logServerProcessor(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME, LOG_MUTEX_NAME, logger);
+	LogServerProcessor logServerProcessor(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME, logger,
+			WaitStrategy(SPIN_COUNT, YIELD_COUNT));
 	while (true)
 	{
 		logServerProcessor.process();
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		logServerProcessor.waitMessages();
 	}
 	delete logger;
 
@@ -3,18 +3,30 @@
 
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/sync/named_mutex.hpp>
 #include <thread>
+#include <chrono>
 #include <random>
 #include <fstream>
+#include <map>
+#include <set>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <iterator>
 #include "../../connection/connection.h"
 #include "../../connection/memory_connection.h"
+#include "../../connection/ring_connection.h"
+#include "../../connection/handshake.h"
+#include "../../concurrency/wait_strategy.h"
 #include "../processor.h"
 #include "../../data_types/shared_object.h"
 #include "../../collections/Map.h"
 #include "../../data_types/contest_info.h"
 #include "../../data_types/request_object.h"
+#include "../../data_types/batch.h"
 #include "../../loggers/server_logger/server_logger.h"
+#include "../../benchmarks/wire_format_benchmark.h"
+#include "../../benchmarks/key_distribution_report.h"
 
 
 using namespace boost::interprocess;
@@ -22,41 +34,210 @@ using namespace boost::interprocess;
 
 class ClientProcessor : public Processor
 {
+public:
+
+	static inline const size_t PIPELINE_DEPTH = 32; // сколько команд из файла может ждать ответа одновременно
+	static inline const size_t BATCH_OPERATIONS = 128; // операций в одном запросе addMany/getMany
+	// пауза перед повтором запросов, получивших RETRY_LATER; удваивается, пока сервер отклоняет
+	static inline const std::chrono::milliseconds RETRY_DELAY_MIN{ 1 };
+	static inline const std::chrono::milliseconds RETRY_DELAY_MAX{ 64 };
+
 private:
 
 	const int thisStatusCode;
 	const Connection* connection;
+	size_t receive_bytes = 0; // сколько байт кадров помещается в кольцо от сервера
 	std::string connectionName;
 	ServerLogger& logger;
+	const SharedEvent* events;
+	WaitStrategy wait_strategy;
+	uint64_t last_correlation_id = 0;
+	std::map<uint64_t, SharedObject> responses; // ответы, пришедшие раньше, чем их начали ждать
+	// запросы без окончательного ответа, для повтора
+	struct Unanswered
+	{
+		std::string request;
+		uint64_t routing_key;
+		std::optional<std::chrono::steady_clock::time_point> deadline; // повтор уходит с оставшимся временем
+	};
+
+	std::map<uint64_t, Unanswered> unanswered;
+	std::set<uint64_t> rejected; // получившие RETRY_LATER и ещё не повторённые
+	std::chrono::milliseconds retry_delay = RETRY_DELAY_MIN;
+	std::optional<std::chrono::milliseconds> request_timeout; // nullopt - срок назначает сервер
+
+	// сколько осталось до срока запроса
+	static std::optional<std::chrono::milliseconds> remaining(const Unanswered& request)
+	{
+		if (!request.deadline)
+			return std::nullopt;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				request.deadline.value() - std::chrono::steady_clock::now());
+	}
 
-	void waitResponse()
+	// routingKey - hashcode записи, по нему сервер выбирает хранилище; 0 - запрос не к одной записи
+	uint64_t sendRequest(const RequestObject<ContestInfo>& request, uint64_t routingKey = 0)
 	{
-		while (SharedObject::getStatusCode(connection->receiveMessage()) == thisStatusCode)
+		last_correlation_id++;
+		std::optional<std::chrono::steady_clock::time_point> deadline;
+		if (request_timeout)
+			deadline = std::chrono::steady_clock::now() + request_timeout.value();
+		auto sent = unanswered.emplace(last_correlation_id,
+				Unanswered{ request.serialize(), routingKey, deadline }).first;
+		connection->sendMessage(SharedObject::Frame(thisStatusCode,
+				SharedObject::RequestResponseCode::REQUEST, sent->second.request, last_correlation_id)
+				.withRoutingKey(routingKey).withTimeout(request_timeout));
+		return last_correlation_id;
+	}
+
+	// запрос к одной записи: ключ считается здесь, и серверу не нужно разбирать ContestInfo
+	uint64_t sendKeyRequest(RequestObject<ContestInfo>::RequestCode requestCode, const ContestInfo& value,
+			const std::string& database, const std::string& schema, const std::string& table)
+	{
+		return sendRequest(RequestObject<ContestInfo>(requestCode, value, database, schema, table), value.hashcode());
+	}
+
+	// сервер отклоняет и все запросы, пришедшие после отклонённого, пока тот не повторят,
+	// поэтому повторяем, когда вернутся все они, и в исходном порядке - тогда запросы не обгонят друг друга
+	void retryLater(uint64_t correlationId)
+	{
+		rejected.insert(correlationId);
+		size_t after = std::distance(unanswered.lower_bound(*rejected.begin()), unanswered.end());
+		if (after != rejected.size())
+			return;
+		std::this_thread::sleep_for(retry_delay);
+		retry_delay = std::min(retry_delay * 2, RETRY_DELAY_MAX);
+		for (uint64_t id: rejected)
 		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
+			const Unanswered& request = unanswered.at(id);
+			connection->sendMessage(SharedObject::Frame(thisStatusCode,
+					SharedObject::RequestResponseCode::REQUEST, request.request, id).withRoutingKey(request.routing_key)
+					.withTimeout(remaining(request)));
 		}
+		rejected.clear();
 	}
 
-public:
+	SharedObject waitResponse(uint64_t correlationId)
+	{
+		while (true)
+		{
+			auto ready = responses.find(correlationId);
+			if (ready != responses.end())
+			{
+				SharedObject response = std::move(ready->second);
+				responses.erase(ready);
+				return response;
+			}
+			wait_strategy.waitFor(*events, [&]
+			{ return connection->hasMessage(thisStatusCode); });
+			auto response = SharedObject::deserialize(connection->receiveMessage(), connection->receiveSize());
+			connection->popMessage();
+			if (response.getRequestResponseCode() == SharedObject::RequestResponseCode::RETRY_LATER)
+			{
+				retryLater(response.getCorrelationId());
+				continue;
+			}
+			if (response.getRequestResponseCode() == SharedObject::RequestResponseCode::TIMEOUT)
+			{
+				std::stringstream log;
+				log << "[CLIENT] Request " << response.getCorrelationId() << " timed out" << std::endl;
+				logger.logSync(log.str(), logger::severity::warning);
+			}
+			unanswered.erase(response.getCorrelationId());
+			retry_delay = RETRY_DELAY_MIN;
+			if (response.getCorrelationId() == correlationId)
+				return response;
+			responses.emplace(response.getCorrelationId(), std::move(response));
+		}
+	}
 
-	ClientProcessor(const int statusCode, const std::string& memNameForConnect,
-			const std::string& mutexNameForConnect, ServerLogger& serverLogger)
-			: thisStatusCode(statusCode), logger(serverLogger)
+	/*
+	 Операция requestCode над каждой из values, запрос на BATCH_OPERATIONS записей; результаты - в порядке values.
+	 Ответ на пачку занимает много слотов, и если ответы не поместятся в кольцо, пока клиент шлёт следующую
+	 пачку, сервер и клиент будут ждать друг друга. Поэтому пачек ждут ответа столько, сколько ответов
+	 помещается в половину кольца (по самому длинному ответу на операцию), а до первого ответа - одна.
+	 */
+	std::vector<Batch::Result> sendBatches(RequestObject<ContestInfo>::RequestCode requestCode,
+			const std::vector<ContestInfo>& values, const std::string& database, const std::string& schema,
+			const std::string& table)
 	{
-		MemoryConnection connect_connection(false, memNameForConnect);
-		named_mutex mutex(open_only, mutexNameForConnect.c_str());
-		scoped_lock<named_mutex> lock(mutex);
-		connect_connection.sendMessage(SharedObject(thisStatusCode,
-                                                    SharedObject::RequestResponseCode::GET_CONNECTION_CLIENT, SharedObject::NULL_DATA));
-		while (SharedObject::getStatusCode(connect_connection.receiveMessage()) == thisStatusCode)
+		std::vector<Batch::Result> results;
+		results.reserve(values.size());
+		std::queue<std::pair<uint64_t, size_t>> pending; // номер запроса и число операций в нём
+		size_t depth = 1;
+		size_t bytesPerOperation = 0;
+		auto takeFront = [&]
 		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
+			SharedObject response = waitResponse(pending.front().first);
+			size_t count = pending.front().second;
+			pending.pop();
+			auto data = response.getData();
+			std::vector<Batch::Result> batch;
+			if (response.getRequestResponseCode() == SharedObject::RequestResponseCode::OK && data)
+			{
+				batch = Batch::decodeResults(data.value());
+				bytesPerOperation = std::max(bytesPerOperation, data->size() / count + 1);
+				depth = std::clamp<size_t>(receive_bytes / 2 / (bytesPerOperation * BATCH_OPERATIONS), 1,
+						PIPELINE_DEPTH);
+			}
+			batch.resize(count); // пачка не выполнена - все её операции ERROR
+			std::move(batch.begin(), batch.end(), std::back_inserter(results));
+		};
+
+		for (size_t begin = 0; begin < values.size(); begin += BATCH_OPERATIONS)
+		{
+			size_t end = std::min(begin + BATCH_OPERATIONS, values.size());
+			std::vector<std::string> serialized;
+			serialized.reserve(end - begin);
+			std::vector<Batch::Operation> operations;
+			operations.reserve(end - begin);
+			for (size_t i = begin; i < end; i++)
+			{
+				serialized.push_back(values[i].serialize());
+				operations.push_back({ requestCode, values[i].hashcode(), serialized.back() });
+			}
+			if (pending.size() >= depth)
+				takeFront();
+			pending.emplace(sendRequest(RequestObject<ContestInfo>(RequestObject<ContestInfo>::RequestCode::BATCH,
+					Batch::encode(operations), database, schema, table)), end - begin);
 		}
-		auto data = SharedObject::deserialize(connect_connection.receiveMessage());
-		auto memName = data.getData();
+		while (!pending.empty())
+			takeFront();
+		return results;
+	}
+
+	static bool responseToBool(const SharedObject& response)
+	{
+		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
+			return false;
+		return response.getData().value() == "true";
+	}
+
+	static std::optional<ContestInfo> responseToContestInfo(const SharedObject& response)
+	{
+		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
+			return std::nullopt;
+		auto data = response.getData();
+		if (!data)
+			return std::nullopt;
+		return ContestInfo::deserialize(data.value());
+	}
+
+public:
+
+	ClientProcessor(const int statusCode, const std::string& memNameForConnect, ServerLogger& serverLogger,
+			const WaitStrategy& waitStrategy = WaitStrategy())
+			: thisStatusCode(statusCode), logger(serverLogger), wait_strategy(waitStrategy)
+	{
+		events = new SharedEvent(true, memNameForConnect + "_events_client" + std::to_string(std::random_device()()));
+		auto memName = requestConnection(memNameForConnect, thisStatusCode,
+				SharedObject::RequestResponseCode::GET_CONNECTION_CLIENT, *events, wait_strategy);
 		if (!memName)
 			throw std::runtime_error("Unable to establish a connection");
-		connection = new MemoryConnection(false, memName.value());
+		auto ring = new RingConnection(false, memName.value());
+		receive_bytes = ring->capacity() * ring->getSlotSize();
+		connection = ring;
+		connection->setReceiveEvent(*events);
 
 		connectionName = memName.value();
 		std::stringstream log;
@@ -69,92 +250,76 @@ public:
 	{
 		connection->sendMessage(SharedObject(thisStatusCode,
 				SharedObject::RequestResponseCode::CLOSE_CONNECTION, SharedObject::NULL_DATA));
+		logger.logSync("[CLIENT] Wait statistics: " + wait_strategy.getPrint() + "\n", logger::severity::debug);
 		delete connection;
+		delete events;
 	}
 
 	bool add(const std::string& database, const std::string& schema, const std::string& table,
 			const ContestInfo& value)
 	{
-		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::ADD,
-				value, database, schema, table);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendKeyRequest(RequestObject<ContestInfo>::RequestCode::ADD,
+				value, database, schema, table)));
 	};
 
 	std::optional<ContestInfo> get(const std::string& database, const std::string& schema,
 			const std::string& table, const ContestInfo& value)
 	{
-		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::GET_KEY,
-				value, database, schema, table);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return std::nullopt;
-		auto data = response.getData();
-		if (!data)
-			return std::nullopt;
-		return ContestInfo::deserialize(data.value());
+		return responseToContestInfo(waitResponse(sendKeyRequest(RequestObject<ContestInfo>::RequestCode::GET_KEY,
+				value, database, schema, table)));
 	};
 
 	bool contains(const std::string& database, const std::string& schema, const std::string& table,
 			const ContestInfo& value)
 	{
-		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::CONTAINS,
-				value, database, schema, table);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendKeyRequest(RequestObject<ContestInfo>::RequestCode::CONTAINS,
+				value, database, schema, table)));
 	};
 
 	bool remove(const std::string& database, const std::string& schema, const std::string& table,
 			const ContestInfo& value)
 	{
-		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::REMOVE,
-				value, database, schema, table);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendKeyRequest(RequestObject<ContestInfo>::RequestCode::REMOVE,
+				value, database, schema, table)));
 	};
 
+	// как add для каждой записи, но пачками - без запроса и ответа на каждую запись
+	std::vector<bool> addMany(const std::string& database, const std::string& schema, const std::string& table,
+			const std::vector<ContestInfo>& values)
+	{
+		std::vector<bool> added;
+		added.reserve(values.size());
+		for (const auto& result: sendBatches(RequestObject<ContestInfo>::RequestCode::ADD, values, database, schema,
+				table))
+		{
+			added.push_back(result.code == SharedObject::RequestResponseCode::OK && result.data == "true");
+		}
+		return added;
+	}
+
+	// как get для каждой записи, но пачками
+	std::vector<std::optional<ContestInfo>> getMany(const std::string& database, const std::string& schema,
+			const std::string& table, const std::vector<ContestInfo>& values)
+	{
+		std::vector<std::optional<ContestInfo>> found;
+		found.reserve(values.size());
+		for (const auto& result: sendBatches(RequestObject<ContestInfo>::RequestCode::GET_KEY, values, database,
+				schema, table))
+		{
+			if (result.code == SharedObject::RequestResponseCode::OK && result.data != SharedObject::NULL_DATA)
+				found.push_back(ContestInfo::deserialize(result.data));
+			else
+				found.push_back(std::nullopt);
+		}
+		return found;
+	}
+
 	bool removeDatabase(const std::string& database)
 	{
 		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::DELETE_DATABASE,
 				RequestObject<ContestInfo>::NULL_DATA, database, RequestObject<ContestInfo>::NULL_DATA,
 				RequestObject<ContestInfo>::NULL_DATA);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendRequest(request)));
 	};
 
 	bool removeSchema(const std::string& database, const std::string& schema)
@@ -162,34 +327,23 @@ public:
 		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::DELETE_SCHEMA,
 				RequestObject<ContestInfo>::NULL_DATA, database, schema,
 				RequestObject<ContestInfo>::NULL_DATA);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendRequest(request)));
 	};
 
 	bool removeTable(const std::string& database, const std::string& schema, const std::string& table)
 	{
 		RequestObject<ContestInfo> request(RequestObject<ContestInfo>::RequestCode::DELETE_TABLE,
 				RequestObject<ContestInfo>::NULL_DATA, database, schema, table);
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::REQUEST, request));
-		waitResponse();
-		auto response = SharedObject::deserialize(connection->receiveMessage());
-		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
-			return false;
-		std::string result = response.getData().value();
-		if (result == "true")
-			return true;
-		return false;
+		return responseToBool(waitResponse(sendRequest(request)));
 	};
 
+	// срок каждого следующего запроса: не получив ответа за timeout, сервер отвечает TIMEOUT,
+	// а операция возвращает false / nullopt. nullopt - срок по умолчанию сервера
+	void setRequestTimeout(std::optional<std::chrono::milliseconds> timeout)
+	{
+		request_timeout = timeout;
+	}
+
 	void log(const std::string& message, logger::severity severity)
 	{
 		logger.logSync(message, severity);
@@ -319,7 +473,9 @@ public:
 			std::cout << "8. Generate random contest info" << std::endl;
 			std::cout << "9. File commands format" << std::endl;
 			std::cout << "10. Read commands from file" << std::endl;
-			std::cout << "11. Exit" << std::endl;
+			std::cout << "11. Wire format benchmark" << std::endl;
+			std::cout << "12. Key distribution over storages" << std::endl;
+			std::cout << "13. Exit" << std::endl;
 			std::cout << "Enter your choice: ";
 
 			choice = readIntFromCin();
@@ -474,6 +630,22 @@ public:
 				fileCommands(file_path);
 				break;
 			case 11:
+				std::cout << "Enter number of iterations: ";
+				std::cout << WireFormatBenchmark::run(std::max(readIntFromCin(), 1));
+				break;
+			case 12:
+			{
+				std::cout << "Enter number of storages: ";
+				int storageCount = readIntFromCin();
+				std::cout << "Enter number of virtual nodes per storage: ";
+				int virtualNodes = readIntFromCin();
+				std::cout << "Enter number of keys: ";
+				int keyCount = readIntFromCin();
+				std::cout << KeyDistributionReport::run(std::max(storageCount, 1), std::max(virtualNodes, 1),
+						std::max(keyCount, 0));
+				break;
+			}
+			case 13:
 				std::cout << "Exiting..." << std::endl;
 				return;
 			default:
@@ -508,12 +680,28 @@ public:
 
 		file.close();
 
+		// команды отправляются, не дожидаясь ответов; ответы печатаются в порядке команд
+		struct PendingCommand
+		{
+			uint64_t correlation_id;
+			std::function<void(const SharedObject&)> print;
+		};
+		std::queue<PendingCommand> pending;
+		size_t depth = std::min(PIPELINE_DEPTH, connection->capacity() / 2 + 1);
+		auto printFront = [&]
+		{
+			pending.front().print(waitResponse(pending.front().correlation_id));
+			pending.pop();
+		};
+
 		for (const auto& command : commands) {
 			if (command.empty()) {
 				continue;
 			}
 
 			std::string cmd = command[0];
+			uint64_t correlationId;
+			std::function<void(const SharedObject&)> print;
 
 			if (cmd == "ADD") {
 				// Обработка команды ADD
@@ -523,14 +711,19 @@ public:
 				// command[4] - CONTEST_INFO
 				if (command.size() != 5)
 					throw std::runtime_error("Incorrect format");
-				if (add(command[1], command[2], command[3], readContestInfoFromString(command[4])))
-				{
-					std::cout << "Contest added successfully." << std::endl;
-				}
-				else
+				correlationId = sendKeyRequest(RequestObject<ContestInfo>::RequestCode::ADD,
+						readContestInfoFromString(command[4]), command[1], command[2], command[3]);
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Failed to add contest." << std::endl;
-				}
+					if (responseToBool(response))
+					{
+						std::cout << "Contest added successfully." << std::endl;
+					}
+					else
+					{
+						std::cout << "Failed to add contest." << std::endl;
+					}
+				};
 			} else if (cmd == "GET") {
 				// Обработка команды GET
 				// command[1] - DATABASE
@@ -540,17 +733,22 @@ public:
 				// command[5] - CONTEST_ID
 				if (command.size() != 6)
 					throw std::runtime_error("Incorrect format");
-				auto result = get(command[1], command[2], command[3],
-						ContestInfo::get_obj_for_search(std::stoi(command[4]), std::stoi(command[5])));
-				if (result)
+				correlationId = sendKeyRequest(RequestObject<ContestInfo>::RequestCode::GET_KEY,
+						ContestInfo::get_obj_for_search(std::stoi(command[4]), std::stoi(command[5])),
+						command[1], command[2], command[3]);
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Found Contest: ";
-					result.value().print();
-				}
-				else
-				{
-					std::cout << "Contest not found." << std::endl;
-				}
+					auto result = responseToContestInfo(response);
+					if (result)
+					{
+						std::cout << "Found Contest: ";
+						result.value().print();
+					}
+					else
+					{
+						std::cout << "Contest not found." << std::endl;
+					}
+				};
 			} else if (cmd == "CONTAINS") {
 				// Обработка команды CONTAINS
 				// command[1] - DATABASE
@@ -559,15 +757,19 @@ public:
 				// command[4] - CONTEST_INFO
 				if (command.size() != 5)
 					throw std::runtime_error("Incorrect format");
-				if (contains(command[1], command[2], command[3],
-						readContestInfoFromString(command[4])))
-				{
-					std::cout << "Contest exists." << std::endl;
-				}
-				else
+				correlationId = sendKeyRequest(RequestObject<ContestInfo>::RequestCode::CONTAINS,
+						readContestInfoFromString(command[4]), command[1], command[2], command[3]);
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Contest does not exist." << std::endl;
-				}
+					if (responseToBool(response))
+					{
+						std::cout << "Contest exists." << std::endl;
+					}
+					else
+					{
+						std::cout << "Contest does not exist." << std::endl;
+					}
+				};
 			} else if (cmd == "REMOVE") {
 				// Обработка команды REMOVE
 				// command[1] - DATABASE
@@ -576,42 +778,60 @@ public:
 				// command[4] - CONTEST_INFO
 				if (command.size() != 5)
 					throw std::runtime_error("Incorrect format");
-				if (remove(command[1], command[2], command[3],
-						readContestInfoFromString(command[4])))
+				correlationId = sendKeyRequest(RequestObject<ContestInfo>::RequestCode::REMOVE,
+						readContestInfoFromString(command[4]), command[1], command[2], command[3]);
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Contest removed successfully." << std::endl;
-				}
-				else
-				{
-					std::cout << "Failed to remove contest." << std::endl;
-				}
+					if (responseToBool(response))
+					{
+						std::cout << "Contest removed successfully." << std::endl;
+					}
+					else
+					{
+						std::cout << "Failed to remove contest." << std::endl;
+					}
+				};
 			} else if (cmd == "REMOVE_DATABASE") {
 				// Обработка команды REMOVE_DATABASE
 				// command[1] - DATABASE
 				if (command.size() != 2)
 					throw std::runtime_error("Incorrect format");
-				if (removeDatabase(command[1]))
+				correlationId = sendRequest(RequestObject<ContestInfo>(
+						RequestObject<ContestInfo>::RequestCode::DELETE_DATABASE,
+						RequestObject<ContestInfo>::NULL_DATA, command[1], RequestObject<ContestInfo>::NULL_DATA,
+						RequestObject<ContestInfo>::NULL_DATA));
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Database removed successfully." << std::endl;
-				}
-				else
-				{
-					std::cout << "Failed to remove database." << std::endl;
-				}
+					if (responseToBool(response))
+					{
+						std::cout << "Database removed successfully." << std::endl;
+					}
+					else
+					{
+						std::cout << "Failed to remove database." << std::endl;
+					}
+				};
 			} else if (cmd == "REMOVE_SCHEMA") {
 				// Обработка команды REMOVE_SCHEMA
 				// command[1] - DATABASE
 				// command[2] - SCHEMA
 				if (command.size() != 3)
 					throw std::runtime_error("Incorrect format");
-				if (removeSchema(command[1], command[2]))
+				correlationId = sendRequest(RequestObject<ContestInfo>(
+						RequestObject<ContestInfo>::RequestCode::DELETE_SCHEMA,
+						RequestObject<ContestInfo>::NULL_DATA, command[1], command[2],
+						RequestObject<ContestInfo>::NULL_DATA));
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Schema removed successfully." << std::endl;
-				}
-				else
-				{
-					std::cout << "Failed to remove schema." << std::endl;
-				}
+					if (responseToBool(response))
+					{
+						std::cout << "Schema removed successfully." << std::endl;
+					}
+					else
+					{
+						std::cout << "Failed to remove schema." << std::endl;
+					}
+				};
 			} else if (cmd == "REMOVE_TABLE") {
 				// Обработка команды REMOVE_TABLE
 				// command[1] - DATABASE
@@ -619,19 +839,40 @@ public:
 				// command[3] - TABLE
 				if (command.size() != 4)
 					throw std::runtime_error("Incorrect format");
-				if (removeTable(command[1], command[2], command[3]))
+				correlationId = sendRequest(RequestObject<ContestInfo>(
+						RequestObject<ContestInfo>::RequestCode::DELETE_TABLE,
+						RequestObject<ContestInfo>::NULL_DATA, command[1], command[2], command[3]));
+				print = [](const SharedObject& response)
 				{
-					std::cout << "Table removed successfully." << std::endl;
-				}
-				else
+					if (responseToBool(response))
+					{
+						std::cout << "Table removed successfully." << std::endl;
+					}
+					else
+					{
+						std::cout << "Failed to remove table." << std::endl;
+					}
+				};
+			} else {
+				while (!pending.empty())
 				{
-					std::cout << "Failed to remove table." << std::endl;
+					printFront();
 				}
-			} else {
 				std::cout << "Invalid command: " << cmd << std::endl;
+				continue;
+			}
+
+			pending.push({ correlationId, print });
+			if (pending.size() >= depth)
+			{
+				printFront();
 			}
 		}
 
+		while (!pending.empty())
+		{
+			printFront();
+		}
 	}
 };
 
@@ -2,73 +2,77 @@
 #define PROGC_LOG_SERVER_PROCESSOR_H
 
 
-#include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/sync/named_mutex.hpp>
 #include <string>
 #include "../../connection/connection.h"
-#include "../../connection/memory_connection.h"
+#include "../../connection/mpsc_ring_connection.h"
+#include "../../concurrency/wait_strategy.h"
 #include "../../data_types/shared_object.h"
 #include "../../loggers/logger.h"
 #include "../processor.h"
 
 
-using namespace boost::interprocess;
-
-
 class LogServerProcessor : public Processor
 {
 private:
 
 	const int thisStatusCode;
 	const Connection* connection;
-	const named_mutex* mutex;
 	const logger* logger;
+	const SharedEvent* events;
+	uint32_t events_seen = 0;
+	WaitStrategy wait_strategy;
 
 public:
 
-	LogServerProcessor(const int statusCode, const std::string& memNameForLog,
-			const std::string& mutexNameForLog, const class logger* logger)
-			: thisStatusCode(statusCode), logger(logger)
+	static inline const size_t LOG_SLOT_COUNT = 256;
+	static inline const size_t LOG_SLOT_SIZE = 4096;
+
+	// в кольцо пишут все процессы сразу, каждый занимает слоты сам, без общего мьютекса
+	LogServerProcessor(const int statusCode, const std::string& memNameForLog, const class logger* logger,
+			const WaitStrategy& waitStrategy = WaitStrategy())
+			: thisStatusCode(statusCode), logger(logger), wait_strategy(waitStrategy)
 	{
-		try
-		{ named_mutex::remove(mutexNameForLog.c_str()); }
-		catch (...)
-		{}
-		connection = new MemoryConnection(true, memNameForLog);
-		mutex = new named_mutex(create_only, mutexNameForLog.c_str());
+		events = new SharedEvent(true, memNameForLog + "_events");
+		connection = new MpscRingConnection(true, memNameForLog, LOG_SLOT_COUNT, LOG_SLOT_SIZE);
+		connection->setReceiveEvent(*events);
 	}
 
 	~LogServerProcessor() override
 	{
 		delete connection;
-		delete mutex;
+		delete events;
 	}
 
+	// спит, пока кто-нибудь не запишет лог (или до таймаута)
+	void waitMessages()
+	{
+		wait_strategy.wait(*events, events_seen);
+		if (wait_strategy.reportDue())
+			logger->log("[LOG_SERVER] Wait statistics: " + wait_strategy.getPrint(), logger::severity::debug);
+	}
+
+	// логи односторонние: ответов нет, писатели ждут только свободного слота в кольце
 	void process() override
 	{
-		if (SharedObject::getStatusCode(connection->receiveMessage()) == thisStatusCode)
-			return;
-		auto shared = SharedObject::deserialize(connection->receiveMessage());
-		auto dataOpt = shared.getData();
-		if (shared.getRequestResponseCode() != SharedObject::RequestResponseCode::LOG || !dataOpt)
+		events_seen = events->sequence();
+		while (connection->hasMessage(thisStatusCode))
 		{
-			connection->sendMessage(SharedObject(thisStatusCode,
-					SharedObject::RequestResponseCode::ERROR, SharedObject::NULL_DATA));
-			return;
-		}
-		const char* ptr = dataOpt.value().c_str();
+			auto shared = SharedObject::deserialize(connection->receiveMessage(), connection->receiveSize());
+			connection->popMessage();
+			auto dataOpt = shared.getData();
+			if (shared.getRequestResponseCode() != SharedObject::RequestResponseCode::LOG || !dataOpt)
+				continue;
+			const char* ptr = dataOpt.value().c_str();
 
-		logger::severity severity = *reinterpret_cast<const logger::severity*>(ptr);
-		ptr += sizeof(logger::severity);
+			logger::severity severity = *reinterpret_cast<const logger::severity*>(ptr);
+			ptr += sizeof(logger::severity);
 
-		size_t stringLength = *reinterpret_cast<const size_t*>(ptr);
-		ptr += sizeof(size_t);
-		std::string string(ptr, stringLength);
+			size_t stringLength = *reinterpret_cast<const size_t*>(ptr);
+			ptr += sizeof(size_t);
+			std::string string(ptr, stringLength);
 
-		logger->log(string, severity);
-
-		connection->sendMessage(SharedObject(thisStatusCode,
-				SharedObject::RequestResponseCode::OK, SharedObject::NULL_DATA));
+			logger->log(string, severity);
+		}
 	}
 };
 
@@ -0,0 +1,188 @@
+#ifndef PROGC_SRC_PROCESSORS_SERVER_IN_FLIGHT_READS_H
+#define PROGC_SRC_PROCESSORS_SERVER_IN_FLIGHT_READS_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../../connection/cached_request.h"
+
+
+/*
+ Чтения (GET_KEY, CONTAINS), отправленные хранилищам и ещё не отвеченные. Такое же чтение другого клиента
+ не идёт к хранилищу, а ждёт ответа на первое (single-flight): горячий ключ стоит хранилищу одного запроса.
+ Присоединиться можно, только если ответ не старше записей, отправленных до присоединения:
+ запись ключа отвязывает его чтения и, пока не отвечена, не даёт начать новые общие;
+ DELETE_* так же действуют на все ключи. Ключи те же, что у ReadCache.
+ */
+
+
+class InFlightReads
+{
+public:
+
+	static inline const size_t DEFAULT_SHARD_COUNT = 16;
+
+private:
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<std::string, std::shared_ptr<CachedRequest>> reads; // ключ + код запроса
+		std::unordered_map<std::string, size_t> writes; // неотвеченные записи по ключу
+		uint64_t epoch = 0; // растёт при каждой записи
+		uint64_t coalesced = 0;
+	};
+
+	std::vector<Shard> shards;
+	std::atomic<size_t> clearing{ 0 }; // неотвеченные DELETE_*
+
+	Shard& shardFor(const std::string& key)
+	{
+		return shards[std::hash<std::string>()(key) % shards.size()];
+	}
+
+	static std::string readKey(const std::string& key, RequestObject<ContestInfo>::RequestCode code)
+	{
+		std::string result;
+		result.reserve(key.size() + 2);
+		result.append(key).push_back('\0');
+		result.push_back(static_cast<char>(code));
+		return result;
+	}
+
+	static void detach(Shard& shard, const std::string& key)
+	{
+		shard.reads.erase(readKey(key, RequestObject<ContestInfo>::RequestCode::GET_KEY));
+		shard.reads.erase(readKey(key, RequestObject<ContestInfo>::RequestCode::CONTAINS));
+	}
+
+public:
+
+	explicit InFlightReads(size_t shardCount = DEFAULT_SHARD_COUNT)
+			: shards(std::max<size_t>(shardCount, 1))
+	{
+	}
+
+	// true - запрос ждёт ответа на такое же чтение, отправлять его не нужно
+	bool join(const std::string& key, RequestObject<ContestInfo>::RequestCode code,
+			std::shared_ptr<Connection> client, uint64_t correlationId)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (clearing || shard.writes.count(key))
+			return false;
+		auto read = shard.reads.find(readKey(key, code));
+		if (read == shard.reads.end())
+			return false;
+		if (!read->second->addFollower(std::move(client), correlationId))
+		{
+			shard.reads.erase(read); // ответ уже ушёл, а finish ещё не успел убрать запрос
+			return false;
+		}
+		shard.coalesced++;
+		return true;
+	}
+
+	// запоминается до отправки чтения и передаётся в lead
+	uint64_t epoch(const std::string& key)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.epoch;
+	}
+
+	// отправленное хранилищу чтение открывается для присоединения, если с epoch ключ не писали
+	void lead(const std::shared_ptr<CachedRequest>& request, uint64_t epoch)
+	{
+		Shard& shard = shardFor(request->getCacheKey());
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (clearing || shard.epoch != epoch || shard.writes.count(request->getCacheKey()) || request->isAnswered())
+			return;
+		shard.reads[readKey(request->getCacheKey(), request->getRequestCode())] = request;
+	}
+
+	// на чтение ответили; вызывается до рассылки ответа присоединившимся
+	void finish(const std::shared_ptr<CachedRequest>& request)
+	{
+		Shard& shard = shardFor(request->getCacheKey());
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto read = shard.reads.find(readKey(request->getCacheKey(), request->getRequestCode()));
+		if (read != shard.reads.end() && read->second == request)
+			shard.reads.erase(read);
+	}
+
+	// до отправки записи хранилищу
+	void beginWrite(const std::string& key)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.epoch++;
+		shard.writes[key]++;
+		detach(shard, key);
+	}
+
+	// запись отвечена или не принята
+	void endWrite(const std::string& key)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto write = shard.writes.find(key);
+		if (write != shard.writes.end() && --write->second == 0)
+			shard.writes.erase(write);
+	}
+
+	// DELETE_* разослан хранилищам
+	void beginClear()
+	{
+		clearing++;
+		for (auto& shard: shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.epoch++;
+			shard.reads.clear();
+		}
+	}
+
+	void endClear()
+	{
+		clearing--;
+	}
+
+	uint64_t getCoalesced()
+	{
+		uint64_t result = 0;
+		for (auto& shard: shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			result += shard.coalesced;
+		}
+		return result;
+	}
+
+	std::string getPrint()
+	{
+		size_t reads = 0;
+		size_t writes = 0;
+		uint64_t coalesced = 0;
+		for (auto& shard: shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			reads += shard.reads.size();
+			writes += shard.writes.size();
+			coalesced += shard.coalesced;
+		}
+		std::stringstream ss;
+		ss << "reads " << reads << ", keys being written " << writes << ", coalesced " << coalesced;
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_PROCESSORS_SERVER_IN_FLIGHT_READS_H
@@ -0,0 +1,263 @@
+#ifndef PROGC_SRC_PROCESSORS_SERVER_MIGRATION_H
+#define PROGC_SRC_PROCESSORS_SERVER_MIGRATION_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <vector>
+#include "../../collections/migration_plan.h"
+#include "../../connection/pending_request.h"
+
+
+/*
+ Переезд ключей со старого кольца на новое, пока сервер обслуживает запросы.
+ Диапазон, у которого сменились владельцы, проходит состояния:
+ PENDING - запросы идут только к источнику (основному старому владельцу), другие старые копии уже удалены;
+ MOVING - записи переносятся пачками, каждая ко всем новым владельцам, запросы к диапазону откладываются;
+ DONE - ключи у новых владельцев, отложенные запросы уходят к ним.
+ Источник удаляет пачку, только когда её приняли все новые владельцы (MIGRATE_COMMIT). Если шаг не удался,
+ пачка возвращается источнику (MIGRATE_ABORT), диапазон снова PENDING, а перенос повторяется через retry_delay;
+ после max_attempts попыток диапазон считается перенесённым, а неотданные записи остаются у источника.
+ Переносится не больше ranges_in_flight диапазонов сразу, пачка - не больше batch_records записей,
+ так что перенос занимает лишь часть пропускной способности хранилищ.
+ Маршрутизируют потоки пула, поэтому всё под мьютексом.
+ */
+
+
+class Migration
+{
+public:
+
+	struct Settings
+	{
+		size_t ranges_in_flight = 1;
+		size_t batch_records = 64;
+		std::chrono::milliseconds retry_delay{ 1000 };
+		size_t max_attempts = 10;
+	};
+
+	enum class RangeState
+	{
+		PENDING,
+		MOVING,
+		DONE,
+	};
+
+private:
+
+	const MigrationPlan plan;
+	const Settings settings;
+	mutable std::mutex mutex;
+	std::vector<RangeState> states;
+	std::vector<std::vector<std::shared_ptr<PendingRequest>>> parked; // запросы к диапазонам в состоянии MOVING
+	std::vector<size_t> unacked; // сколько новых владельцев ещё не приняли текущую пачку диапазона
+	std::vector<size_t> batch_records; // записей в текущей пачке диапазона
+	std::vector<uint64_t> attempts; // номер попытки переноса диапазона, растёт с каждым retryRange
+	std::deque<std::pair<size_t, std::chrono::steady_clock::time_point>> retries; // диапазон и когда повторить
+	bool announced = false; // хранилища получили план
+	size_t next_range = 0;
+	size_t moving = 0;
+	size_t done = 0;
+	uint64_t moved_records = 0;
+	uint64_t parked_total = 0;
+	uint64_t retried = 0;
+	const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+public:
+
+	Migration(MigrationPlan plan, const Settings& settings)
+			: plan(std::move(plan)), settings{ std::max<size_t>(settings.ranges_in_flight, 1),
+											   std::max<size_t>(settings.batch_records, 1), settings.retry_delay,
+											   std::max<size_t>(settings.max_attempts, 1) }
+	{
+		states.assign(this->plan.getRanges().size(), RangeState::PENDING);
+		parked.resize(states.size());
+		unacked.assign(states.size(), 0);
+		batch_records.assign(states.size(), 0);
+		attempts.assign(states.size(), 0);
+	}
+
+	const MigrationPlan& getPlan() const
+	{
+		return plan;
+	}
+
+	size_t getBatchRecords() const
+	{
+		return settings.batch_records;
+	}
+
+	struct Target
+	{
+		std::vector<size_t> owners; // пуст, если диапазон ключа переносится
+		size_t moving_range = MigrationPlan::NONE;
+	};
+
+	// как route, но ничего не откладывает: для переносимого диапазона - его номер
+	Target locate(uint64_t keyHash) const
+	{
+		size_t range = plan.rangeFor(keyHash);
+		if (range == MigrationPlan::NONE)
+			return { plan.getTo().nodesFor(keyHash, plan.getToReplicas()) };
+
+		std::lock_guard<std::mutex> lock(mutex);
+		switch (states[range])
+		{
+		case RangeState::PENDING:
+			return { { plan.getRanges()[range].source() } };
+		case RangeState::MOVING:
+			return { {}, range };
+		default:
+			return { plan.getRanges()[range].to };
+		}
+	}
+
+	// хранилища с ключом, основное первое; nullopt - запрос отложен до конца переноса его диапазона
+	std::optional<std::vector<size_t>> route(uint64_t keyHash, const std::shared_ptr<PendingRequest>& request)
+	{
+		size_t range = plan.rangeFor(keyHash);
+		if (range == MigrationPlan::NONE)
+			return plan.getTo().nodesFor(keyHash, plan.getToReplicas());
+
+		std::lock_guard<std::mutex> lock(mutex);
+		switch (states[range])
+		{
+		case RangeState::PENDING:
+			return std::vector<size_t>{ plan.getRanges()[range].source() };
+		case RangeState::MOVING:
+			parked[range].push_back(request);
+			parked_total++;
+			return std::nullopt;
+		default:
+			return plan.getRanges()[range].to;
+		}
+	}
+
+	void setAnnounced()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		announced = true;
+	}
+
+	// диапазоны, перенос которых можно начать сейчас: сначала новые, потом те, чей повтор подошёл
+	std::vector<size_t> startRanges()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<size_t> result;
+		auto now = std::chrono::steady_clock::now();
+		while (announced && moving < settings.ranges_in_flight)
+		{
+			size_t range;
+			if (next_range < states.size())
+				range = next_range++;
+			else if (!retries.empty() && retries.front().second <= now)
+			{
+				range = retries.front().first;
+				retries.pop_front();
+			}
+			else
+				break;
+			states[range] = RangeState::MOVING;
+			result.push_back(range);
+			moving++;
+		}
+		return result;
+	}
+
+	void addMovedRecords(size_t count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		moved_records += count;
+	}
+
+	uint64_t getAttempt(size_t range) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return attempts[range];
+	}
+
+	// ответы на шаги уже законченной или прерванной попытки не нужны
+	bool isMoving(size_t range, uint64_t attempt) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return states[range] == RangeState::MOVING && attempts[range] == attempt;
+	}
+
+	// пачка из records записей разослана count новым владельцам
+	void expectAcks(size_t range, size_t count, size_t records)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		unacked[range] = count;
+		batch_records[range] = records;
+	}
+
+	// true - пачку приняли все новые владельцы, её записи считаются перенесёнными
+	bool ack(size_t range)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (unacked[range] != 0 && --unacked[range] != 0)
+			return false;
+		moved_records += batch_records[range];
+		batch_records[range] = 0;
+		return true;
+	}
+
+	// возвращает отложенные запросы диапазона, их надо отправить новому владельцу
+	std::vector<std::shared_ptr<PendingRequest>> finishRange(size_t range)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (states[range] != RangeState::MOVING)
+			return {};
+		states[range] = RangeState::DONE;
+		moving--;
+		done++;
+		return std::move(parked[range]);
+	}
+
+	bool canRetry(size_t range) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return attempts[range] + 1 < settings.max_attempts;
+	}
+
+	// шаг переноса не удался: диапазон снова обслуживает источник, перенос повторится через retry_delay.
+	// Возвращает отложенные запросы диапазона, их надо отправить источнику
+	std::vector<std::shared_ptr<PendingRequest>> retryRange(size_t range)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (states[range] != RangeState::MOVING)
+			return {};
+		states[range] = RangeState::PENDING;
+		moving--;
+		attempts[range]++;
+		unacked[range] = 0;
+		retries.emplace_back(range, std::chrono::steady_clock::now() + settings.retry_delay);
+		retried++;
+		return std::move(parked[range]);
+	}
+
+	bool finished() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return announced && done == states.size();
+	}
+
+	std::string getPrint() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - started).count();
+		std::stringstream ss;
+		ss << "ranges " << done << "/" << states.size() << " done, " << moving << " moving, records moved "
+		   << moved_records << ", requests parked " << parked_total << ", retries " << retried << ", " << elapsed << " ms";
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_PROCESSORS_SERVER_MIGRATION_H
@@ -0,0 +1,220 @@
+#ifndef PROGC_SRC_PROCESSORS_SERVER_READ_CACHE_H
+#define PROGC_SRC_PROCESSORS_SERVER_READ_CACHE_H
+
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../../data_types/contest_info.h"
+#include "../../data_types/request_object.h"
+
+
+/*
+ Ответы хранилищ на GET_KEY и CONTAINS, чтобы повторное чтение не ходило к хранилищу.
+ Ключ - база, схема, таблица и ключ записи (ContestInfo::hashcode, в нём оба id). Кэш разбит на шарды со своим мьютексом и LRU,
+ потоки пула почти не мешают друг другу.
+ Запись ключа (ADD, REMOVE) удаляет его из кэша дважды: при отправке хранилищу и при ответе.
+ Ответ на чтение кладётся, только если с момента промаха в шарде ничего не удалялось, - иначе
+ он мог быть прочитан до записи и устарел. DELETE_* очищают весь кэш.
+ */
+
+
+class ReadCache
+{
+public:
+
+	static inline const size_t DEFAULT_SHARD_COUNT = 16;
+
+	struct Response
+	{
+		int code;
+		std::string data;
+	};
+
+	struct Statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t invalidations = 0;
+		size_t size = 0;
+	};
+
+private:
+
+	struct Entry
+	{
+		std::string key;
+		std::optional<Response> get_key;
+		std::optional<Response> contains;
+	};
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::list<Entry> entries; // от недавних к давним
+		std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // ключи указывают в entries
+		uint64_t epoch = 0; // растёт при каждом удалении из шарда
+		Statistics statistics;
+	};
+
+	const size_t shard_capacity;
+	std::vector<Shard> shards;
+
+	Shard& shardFor(const std::string& key)
+	{
+		return shards[std::hash<std::string>()(key) % shards.size()];
+	}
+
+	static std::optional<Response>& slot(Entry& entry, RequestObject<ContestInfo>::RequestCode code)
+	{
+		return code == RequestObject<ContestInfo>::RequestCode::GET_KEY ? entry.get_key : entry.contains;
+	}
+
+	static void erase(Shard& shard, const std::string& key)
+	{
+		auto entry = shard.index.find(key);
+		if (entry == shard.index.end())
+			return;
+		auto position = entry->second;
+		shard.index.erase(entry);
+		shard.entries.erase(position);
+	}
+
+public:
+
+	explicit ReadCache(size_t capacity, size_t shardCount = DEFAULT_SHARD_COUNT)
+			: shard_capacity(std::max<size_t>(1, (capacity + shardCount - 1) / std::max<size_t>(shardCount, 1))),
+			  shards(std::max<size_t>(shardCount, 1))
+	{
+	}
+
+	static bool isRead(RequestObject<ContestInfo>::RequestCode code)
+	{
+		return code == RequestObject<ContestInfo>::RequestCode::GET_KEY
+			   || code == RequestObject<ContestInfo>::RequestCode::CONTAINS;
+	}
+
+	static bool isWrite(RequestObject<ContestInfo>::RequestCode code)
+	{
+		return code == RequestObject<ContestInfo>::RequestCode::ADD
+			   || code == RequestObject<ContestInfo>::RequestCode::REMOVE;
+	}
+
+	static std::string makeKey(std::string_view database, std::string_view schema, std::string_view table,
+			uint64_t keyHash)
+	{
+		std::string key;
+		key.reserve(database.size() + schema.size() + table.size() + 3 + sizeof(keyHash));
+		key.append(database).push_back('\0');
+		key.append(schema).push_back('\0');
+		key.append(table).push_back('\0');
+		key.append(reinterpret_cast<const char*>(&keyHash), sizeof(keyHash)); // последнее поле, длина постоянная
+		return key;
+	}
+
+	std::optional<Response> get(const std::string& key, RequestObject<ContestInfo>::RequestCode code)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto entry = shard.index.find(key);
+		if (entry == shard.index.end() || !slot(*entry->second, code))
+		{
+			shard.statistics.misses++;
+			return std::nullopt;
+		}
+		shard.statistics.hits++;
+		shard.entries.splice(shard.entries.begin(), shard.entries, entry->second);
+		return slot(*entry->second, code);
+	}
+
+	// запоминается при промахе и передаётся в put
+	uint64_t epoch(const std::string& key)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.epoch;
+	}
+
+	void put(const std::string& key, RequestObject<ContestInfo>::RequestCode code, Response response,
+			uint64_t epoch)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (shard.epoch != epoch)
+			return;
+		auto entry = shard.index.find(key);
+		if (entry != shard.index.end())
+		{
+			shard.entries.splice(shard.entries.begin(), shard.entries, entry->second);
+			slot(*entry->second, code) = std::move(response);
+			return;
+		}
+
+		if (shard.entries.size() >= shard_capacity)
+		{
+			shard.index.erase(shard.entries.back().key);
+			shard.entries.pop_back();
+			shard.statistics.evictions++;
+		}
+		shard.entries.push_front(Entry{ key, std::nullopt, std::nullopt });
+		slot(shard.entries.front(), code) = std::move(response);
+		shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+	}
+
+	void invalidate(const std::string& key)
+	{
+		Shard& shard = shardFor(key);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.epoch++;
+		shard.statistics.invalidations++;
+		erase(shard, key);
+	}
+
+	void clear()
+	{
+		for (auto& shard: shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.epoch++;
+			shard.statistics.invalidations += shard.entries.size();
+			shard.index.clear();
+			shard.entries.clear();
+		}
+	}
+
+	Statistics getStatistics()
+	{
+		Statistics result;
+		for (auto& shard: shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			result.hits += shard.statistics.hits;
+			result.misses += shard.statistics.misses;
+			result.evictions += shard.statistics.evictions;
+			result.invalidations += shard.statistics.invalidations;
+			result.size += shard.entries.size();
+		}
+		return result;
+	}
+
+	std::string getPrint()
+	{
+		Statistics statistics = getStatistics();
+		std::stringstream ss;
+		ss << "size " << statistics.size << "/" << shard_capacity * shards.size() << ", hits " << statistics.hits
+		   << ", misses " << statistics.misses << ", evictions " << statistics.evictions << ", invalidations "
+		   << statistics.invalidations;
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_PROCESSORS_SERVER_READ_CACHE_H
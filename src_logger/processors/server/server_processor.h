@@ -3,18 +3,41 @@
 
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/sync/named_mutex.hpp>
 #include <thread>
 #include <queue>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
 #include "../../connection/connection.h"
 #include "../../connection/memory_connection.h"
+#include "../../connection/ring_connection.h"
+#include "../../collections/BPlusTree/BPlusTreeMap.h"
+#include "../../connection/mpsc_ring_connection.h"
+#include "../../connection/socket_connection.h"
+#include "../../concurrency/epoll_loop.h"
+#include "../../concurrency/wait_strategy.h"
+#include "../../concurrency/work_stealing_pool.h"
 #include "../processor.h"
 #include "../../data_types/shared_object.h"
 #include "../../data_types/request_object.h"
 #include "../../data_types/contest_info.h"
+#include "../../data_types/frame_pack.h"
 #include "../../collections/Map.h"
-#include "../../collections/BPlusTree/BPlusTreeMap.h"
-#include "../../connection/multiple_request.h"
+#include "../../collections/consistent_hash_ring.h"
+#include "../../connection/pending_request.h"
+#include "../../connection/scatter_gather_request.h"
+#include "../../connection/synchronized_connection.h"
+#include "../../connection/migration_request.h"
+#include "../../connection/replicated_request.h"
+#include "../../connection/cached_request.h"
+#include "../../connection/batch_request.h"
+#include "./migration.h"
+#include "./read_cache.h"
+#include "./in_flight_reads.h"
+#include "./load_tracker.h"
+#include "./timer_wheel.h"
 
 
 using namespace boost::interprocess;
@@ -22,72 +45,490 @@ using namespace boost::interprocess;
 
 struct Storage
 {
-	std::unique_ptr<MemoryConnection> connection;
-	std::shared_ptr<Connection> client_requested;
-	std::queue<std::shared_ptr<Connection>> clients_to_process;
+	// запрос и его номер по порядку прихода к хранилищу
+	struct Queued
+	{
+		uint64_t sequence;
+		std::shared_ptr<PendingRequest> request;
+		size_t cost = 0; // длина кадра, для честного разделения между клиентами
+	};
+
+	// обычные запросы одного клиента и накопленный им кредит в байтах (deficit round-robin)
+	struct ClientQueue
+	{
+		std::deque<Queued> requests;
+		size_t deficit = 0;
+	};
+
+	std::unique_ptr<Connection> connection;
+	// отправленные хранилищу запросы по номеру на этом соединении; хранилище возвращает номер в ответе
+	std::map<uint64_t, std::shared_ptr<PendingRequest>> in_flight;
+	uint64_t next_link_id = 1;
+	size_t depth = 1; // сколько запросов может быть у хранилища одновременно
+	size_t peak_in_flight = 0;
+	uint64_t forwarded = 0;
+	uint64_t packs = 0; // кадров PACKED
+	uint64_t packed = 0; // запросов в них
+	uint64_t expired = 0; // не отправлены: срок истёк в очереди
+	bool failed = false; // прислало кадр, который не разобрать: ответы больше не читаются, запросы не уходят
+	std::vector<uint64_t> outgoing; // набранные и ещё не отправленные (не влезли в кольцо) запросы, по номеру в in_flight
+	// дальше до takeInbox трогает только поток, владеющий хранилищем
+	std::map<const Connection*, ClientQueue> client_queues;
+	std::deque<const Connection*> active_clients; // клиенты с запросами в client_queues, по кругу
+	// запросы самого сервера (перенос, план ребалансировки) не обгоняют пришедшие раньше запросы клиентов
+	// и не пропускают вперёд пришедшие позже
+	std::queue<Queued> server_to_process;
+	size_t queued = 0; // в client_queues и server_to_process
+	// приоритетная полоса: запросы ко всем хранилищам не ждут за обычной очередью каждого из них,
+	// но не обгоняют пришедшие раньше запросы своего клиента
+	std::deque<Queued> priority_to_process;
+	std::mutex inbox_mutex;
+	uint64_t next_sequence = 0;
+	std::queue<Queued> inbox; // сюда маршрутизируют запросы потоки клиентов
+	std::queue<Queued> priority_inbox;
+	// обычные запросы клиентов в ящике и в очереди, всего и по клиентам; под inbox_mutex
+	size_t admitted = 0;
+	std::map<const Connection*, size_t> admitted_by_client;
+	uint64_t rejected = 0;
+	std::atomic<bool> scheduled{ false }; // хранилищем владеет не больше одного потока сразу
+	// запросы, отданные хранилищу и ещё не отвеченные (в ящике, в очереди и в работе);
+	// очередь читать может только владелец, а по нагрузке выбирают реплику потоки клиентов
+	std::atomic<size_t> load{ 0 };
+
+	static inline const size_t DRR_QUANTUM = 1024; // байт кадров за один ход клиента
+
+	// без ограничения очереди: реплики записи, отложенные переносом запросы, запросы сервера
+	void push(std::shared_ptr<PendingRequest> request, bool priority = false)
+	{
+		load++;
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		if (!priority)
+			admit(request->getConnection().get());
+		(priority ? priority_inbox : inbox).push({ next_sequence++, std::move(request) });
+	}
+
+	// false - очередь хранилища или доля в ней этого клиента заполнена, запрос не принят
+	bool tryPush(std::shared_ptr<PendingRequest> request, size_t queueLimit, size_t clientLimit)
+	{
+		const Connection* client = request->getConnection().get();
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		auto clientAdmitted = admitted_by_client.find(client);
+		if (admitted >= queueLimit
+			|| (clientAdmitted != admitted_by_client.end() && clientAdmitted->second >= clientLimit))
+		{
+			rejected++;
+			return false;
+		}
+		load++;
+		admit(client);
+		inbox.push({ next_sequence++, std::move(request) });
+		return true;
+	}
+
+	bool hasInbox()
+	{
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		return !inbox.empty() || !priority_inbox.empty();
+	}
+
+	// переносит новые запросы в свою очередь; вызывает только владелец
+	void takeInbox()
+	{
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		while (!inbox.empty())
+		{
+			Queued& next = inbox.front();
+			const Connection* client = next.request->getConnection().get();
+			queued++;
+			if (!client)
+			{
+				server_to_process.push(std::move(next));
+				inbox.pop();
+				continue;
+			}
+			next.cost = SharedObject::View(next.request->receiveMessage(), next.request->receiveSize(), false).size();
+			ClientQueue& queue = client_queues[client];
+			if (queue.requests.empty())
+			{
+				queue.deficit = DRR_QUANTUM;
+				active_clients.push_back(client);
+			}
+			queue.requests.push_back(std::move(next));
+			inbox.pop();
+		}
+		while (!priority_inbox.empty())
+		{
+			priority_to_process.push_back(std::move(priority_inbox.front()));
+			priority_inbox.pop();
+		}
+	}
+
+	bool hasQueued() const
+	{
+		return queued != 0;
+	}
+
+	// следующий обычный запрос на отправку; вызывает только владелец, если hasQueued
+	// клиенты ходят по кругу и за ход тратят не больше накопленного кредита, так что клиент с длинной очередью
+	// не задерживает остальных
+	std::shared_ptr<PendingRequest> takeQueued()
+	{
+		uint64_t barrier = server_to_process.empty() ? UINT64_MAX : server_to_process.front().sequence;
+		bool clientsBefore = false;
+		for (const Connection* client: active_clients)
+		{
+			clientsBefore = clientsBefore || client_queues.at(client).requests.front().sequence < barrier;
+		}
+		queued--;
+		if (!clientsBefore)
+		{
+			auto request = std::move(server_to_process.front().request);
+			server_to_process.pop();
+			return request;
+		}
+
+		while (true)
+		{
+			const Connection* client = active_clients.front();
+			ClientQueue& queue = client_queues.at(client);
+			Queued& next = queue.requests.front();
+			if (next.sequence > barrier || queue.deficit < next.cost)
+			{
+				// пришедшие позже запроса сервера ждут его, кредит копится только у тех, кто мог идти
+				if (next.sequence < barrier)
+					queue.deficit += DRR_QUANTUM;
+				active_clients.pop_front();
+				active_clients.push_back(client);
+				continue;
+			}
+
+			queue.deficit -= next.cost;
+			auto request = std::move(next.request);
+			queue.requests.pop_front();
+			if (queue.requests.empty())
+			{
+				client_queues.erase(client);
+				active_clients.pop_front();
+			}
+			std::lock_guard<std::mutex> lock(inbox_mutex);
+			admitted--;
+			auto clientAdmitted = admitted_by_client.find(client);
+			if (--clientAdmitted->second == 0)
+				admitted_by_client.erase(clientAdmitted);
+			return request;
+		}
+	}
+
+	// приоритетный запрос ждёт, пока не уйдут пришедшие раньше обычные запросы его клиента
+	// обычный запрос своего приоритетного не ждёт: к отправке обычных все не ждущие приоритетные уже ушли
+	bool waitsForQueued(const Queued& priorityRequest) const
+	{
+		auto client = client_queues.find(priorityRequest.request->getConnection().get());
+		return client != client_queues.end() && client->second.requests.front().sequence < priorityRequest.sequence;
+	}
+
+	std::string getPrint()
+	{
+		std::stringstream ss;
+		ss << connection->getName() << ": depth " << depth << ", in flight " << in_flight.size() << ", peak "
+		   << peak_in_flight << ", queued " << queued << " from " << active_clients.size() << " clients + "
+		   << priority_to_process.size() << " priority, load " << load << ", forwarded " << forwarded
+		   << " (" << packed << " in " << packs << " packs), rejected " << rejected << ", expired " << expired;
+		return ss.str();
+	}
+
+private:
+
+	// под inbox_mutex
+	void admit(const Connection* client)
+	{
+		if (!client)
+			return;
+		admitted++;
+		admitted_by_client[client]++;
+	}
 };
 
+/*
+ Сервер работает проходами: главный поток принимает подключения и раздаёт работу пулу,
+ а задачи пула разбирают запросы клиентов (задача на клиента) и пересылают их хранилищам
+ (задача на хранилище, не больше одной сразу). Проход заканчивается, когда пул выполнил всё.
+ */
+
 class ServerProcessor : public Processor
 {
 private:
 
-	std::vector<Storage> storages;
-	std::vector<std::shared_ptr<Connection>> clients;
+	struct SocketClient
+	{
+		std::shared_ptr<SocketConnection> socket;
+		std::shared_ptr<Connection> synchronized; // через него отвечают потоки хранилищ
+	};
+
+	struct RingClient
+	{
+		std::shared_ptr<RingConnection> ring;
+		std::shared_ptr<Connection> synchronized; // через него отвечают потоки хранилищ
+	};
+
+	std::deque<Storage> storages; // deque - ссылки на хранилища не меняются при добавлении
+	std::vector<RingClient> clients;
 	int client_id = 0;
-	int storage_id = 0;
+	// прогретые соединения: выдаются при подключении сразу, без shm_open/truncate/mmap
+	std::deque<std::shared_ptr<RingConnection>> client_pool;
+	std::deque<std::unique_ptr<RingConnection>> storage_pool; // storage_pool[k] называется "storage" + (storages.size() + k)
 	const int this_status_code;
 	const Connection* connection;
-	const named_mutex* connection_mutex;
 	ServerLogger& logger;
+	const SharedEvent* events; // звонит при каждом кадре, пришедшем серверу
+	uint32_t events_seen = 0;
+	WaitStrategy wait_strategy;
 
-	std::shared_ptr<Connection> fake_connection_for_multiple_request_for_rebalance_storages;
-	bool rebalance_request_active = false;
+	std::shared_ptr<ScatterGatherRequest> rebalance_announcement; // план, разосланный хранилищам
 	bool need_to_create_rebalance_request = false;
+	std::unique_ptr<Migration> migration; // меняется только между проходами
+	Migration::Settings migration_settings;
+
+	// подключения через сокеты; обрабатываются только те, о которых сообщил epoll
+	std::unique_ptr<SocketListener> listener;
+	std::unique_ptr<EpollLoop> epoll;
+	std::map<int, std::unique_ptr<SocketConnection>> socket_handshakes; // ещё не назвались клиентом или хранилищем
+	std::map<int, SocketClient> socket_clients;
+	std::map<int, const SocketConnection*> socket_storages;
+	std::set<int> ready_sockets;
+	std::vector<int> ready_socket_clients; // клиенты-сокеты, которые разбираются в этом проходе
+
+	const size_t default_storage_depth;
+	std::map<size_t, size_t> storage_depths; // заданные через setStorageDepth, по номеру хранилища
+	ConsistentHashRing ring; // каким должно стать размещение ключей; меняется только между проходами
+	ConsistentHashRing placement; // где ключи лежат сейчас, если переезд не идёт
+	size_t replication_factor = 1; // сколько хранилищ держат каждый ключ
+	size_t placement_replicas = 1; // ... в placement
+	std::unique_ptr<ReadCache> read_cache; // nullptr - кэш выключен
+	std::unique_ptr<InFlightReads> in_flight_reads; // nullptr - одинаковые чтения не объединяются
+	LoadTracker load_tracker;
+	LoadTracker::Settings load_settings;
+	std::map<size_t, size_t> storage_virtual_nodes; // заданные через setStorageVirtualNodes
+	size_t queue_limit; // сколько обычных запросов клиентов может ждать у хранилища
+	size_t client_queue_limit; // ... из них от одного клиента
+	size_t pack_bytes_limit; // сколько байт запросов упаковывать в один кадр хранилищу, 0 - не упаковывать
+	std::chrono::milliseconds request_timeout; // срок запросов, пришедших без него; 0 - без срока
+	TimerWheel timer_wheel; // сроки запросов клиентов, разбирает главный поток
+	std::atomic<uint64_t> timed_out{ 0 }; // клиентам ответил TIMEOUT
+	// клиенты, получившие RETRY_LATER: до повтора отклонённого запроса отклоняются и следующие,
+	// иначе они обогнали бы его; номер отклонённого по клиенту
+	std::mutex retry_mutex;
+	std::map<const Connection*, uint64_t> retry_from;
+
+	WorkStealingPool workers; // объявлен последним, чтобы остановиться раньше всего, с чем работают задачи
 
 public:
 
-	ServerProcessor(const int statusCode, const std::string& memNameForConnect,
-			const std::string& mutexNameForConnect, ServerLogger& serverLogger)
-			: this_status_code(statusCode), logger(serverLogger)
+	// кадры длиннее слота передаются фрагментами, размер слота лишь экономит их число
+	static inline const size_t CLIENT_SLOT_COUNT = RingConnection::DEFAULT_SLOT_COUNT;
+	static inline const size_t CLIENT_SLOT_SIZE = RingConnection::DEFAULT_SLOT_SIZE;
+	static inline const size_t STORAGE_SLOT_COUNT = 64;
+	static inline const size_t STORAGE_SLOT_SIZE = 16 * 1024;
+	static inline const size_t CONNECT_SLOT_COUNT = 64; // запросы подключения, ожидающие сервера
+	static inline const size_t CLIENT_POOL_SIZE = 32;
+	static inline const size_t STORAGE_POOL_SIZE = 2;
+	static inline const size_t POOL_REFILL_PER_TICK = 8; // пополнение не должно надолго задерживать запросы
+	static inline const size_t DEFAULT_WORKER_COUNT = 2;
+	static inline const size_t DEFAULT_STORAGE_DEPTH = 8;
+	static inline const size_t PRIORITY_SLOTS = 4; // сверх глубины, только для приоритетной полосы
+	static inline const size_t DEFAULT_READ_CACHE_CAPACITY = 64 * 1024; // записей
+	static inline const size_t DEFAULT_QUEUE_LIMIT = 256;
+	static inline const size_t DEFAULT_CLIENT_QUEUE_LIMIT = 64;
+	static inline const std::chrono::milliseconds DEFAULT_REQUEST_TIMEOUT{ 10000 };
+	// кадр PACKED вместе с заголовком помещается в слот соединения с хранилищем
+	static inline const size_t DEFAULT_PACK_BYTES_LIMIT = STORAGE_SLOT_SIZE - SharedObject::MAX_HEADER_SIZE
+														  - WireFormat::CHECKSUM_SIZE;
+
+	// listenAddress - адрес для подключений через сокеты (unix:/путь или tcp:хост:порт), пустой - только память
+	ServerProcessor(const int statusCode, const std::string& memNameForConnect, ServerLogger& serverLogger,
+			const std::string& listenAddress = "", const WaitStrategy& waitStrategy = WaitStrategy(),
+			size_t workerCount = DEFAULT_WORKER_COUNT, size_t storageDepth = DEFAULT_STORAGE_DEPTH)
+			: this_status_code(statusCode), logger(serverLogger), wait_strategy(waitStrategy),
+			  default_storage_depth(storageDepth),
+			  read_cache(std::make_unique<ReadCache>(DEFAULT_READ_CACHE_CAPACITY)),
+			  in_flight_reads(std::make_unique<InFlightReads>()), queue_limit(DEFAULT_QUEUE_LIMIT),
+			  client_queue_limit(DEFAULT_CLIENT_QUEUE_LIMIT), pack_bytes_limit(DEFAULT_PACK_BYTES_LIMIT),
+			  request_timeout(DEFAULT_REQUEST_TIMEOUT), workers(workerCount)
 	{
-		try
-		{ named_mutex::remove(mutexNameForConnect.c_str()); }
-		catch (...)
-		{}
-		connection = new MemoryConnection(true, memNameForConnect);
-		connection_mutex = new named_mutex(create_only, mutexNameForConnect.c_str());
+		events = new SharedEvent(true, memNameForConnect + "_events");
+		connection = new MpscRingConnection(true, memNameForConnect, CONNECT_SLOT_COUNT);
+		connection->setReceiveEvent(*events);
+		refillPools(CLIENT_POOL_SIZE);
 
-		connection->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
-				SharedObject::NULL_DATA));
+		if (!listenAddress.empty())
+		{
+			listener = std::make_unique<SocketListener>(listenAddress);
+			epoll = std::make_unique<EpollLoop>([this]
+			{ events->notify(); });
+			epoll->watch(listener->getDescriptor());
 
-		fake_connection_for_multiple_request_for_rebalance_storages = std::make_shared<MemoryConnection>(true,
-				"rebalance666");
+			std::stringstream log;
+			log << "[SERVER] Listen on " << listenAddress << std::endl;
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::debug);
+		}
 	}
 
 	~ServerProcessor() override
 	{
+		epoll = nullptr; // поток epoll звонит в events
 		delete connection;
-		delete connection_mutex;
+		delete events;
+	}
+
+	// спит, пока не придёт кадр на любое из соединений (или до таймаута)
+	// пока есть запросы со сроком, сон не дольше тика колеса, иначе TIMEOUT опоздает на весь таймаут,
+	// и так же, пока клиентам и сокетам есть что дописать (flushOutbound)
+	void waitMessages()
+	{
+		auto timeout = timer_wheel.empty() && !hasOutbound() ? SharedEvent::IDLE_TIMEOUT : timer_wheel.getTick();
+		wait_strategy.wait(*events, events_seen, timeout);
+		if (wait_strategy.reportDue())
+		{
+			std::stringstream log;
+			log << "[SERVER] Wait statistics: " << wait_strategy.getPrint() << std::endl;
+			for (auto& storage: storages)
+			{
+				log << "[SERVER] Storage " << storage.getPrint() << std::endl;
+			}
+			if (migration)
+				log << "[SERVER] Rebalance: " << migration->getPrint() << std::endl;
+			if (read_cache)
+				log << "[SERVER] Read cache: " << read_cache->getPrint() << std::endl;
+			if (in_flight_reads)
+				log << "[SERVER] In-flight reads: " << in_flight_reads->getPrint() << std::endl;
+			log << "[SERVER] Deadlines: " << timer_wheel.getPrint() << ", timed out " << timed_out << std::endl;
+			log << "[SERVER] Load: " << load_tracker.getPrint() << std::endl;
+			logger.log(log.str(), logger::severity::debug);
+		}
+	}
+
+	// доля ключей хранилища пропорциональна числу его точек на кольце; для подключённого запускает ребалансировку
+	void setStorageVirtualNodes(size_t storageIndex, size_t virtualNodes)
+	{
+		storage_virtual_nodes[storageIndex] = virtualNodes;
+		if (storageIndex < storages.size())
+		{
+			ring.addNode(storageIndex, virtualNodes);
+			need_to_create_rebalance_request = true;
+		}
+	}
+
+	// сколько ответов на чтения помнить, 0 - не кэшировать; вызывается до начала работы
+	void setReadCacheCapacity(size_t capacity)
+	{
+		read_cache = capacity ? std::make_unique<ReadCache>(capacity) : nullptr;
+	}
+
+	// одинаковые чтения, пришедшие, пока первое из них у хранилища, ждут его ответа; вызывается до начала работы
+	void setReadCoalescing(bool enabled)
+	{
+		in_flight_reads = enabled ? std::make_unique<InFlightReads>() : nullptr;
+	}
+
+	// nullopt - кэш выключен
+	std::optional<ReadCache::Statistics> getReadCacheStatistics()
+	{
+		if (!read_cache)
+			return std::nullopt;
+		return read_cache->getStatistics();
+	}
+
+	// запись уходит всем replicationFactor хранилищам ключа, чтение - наименее загруженному из них
+	// вызывается между проходами; ключи докопируются ребалансировкой
+	void setReplicationFactor(size_t replicationFactor)
+	{
+		replication_factor = std::max<size_t>(replicationFactor, 1);
+		if (!storages.empty())
+			need_to_create_rebalance_request = true;
+	}
+
+	// когда хранилище считается перегруженным и можно ли отдавать часть его ключей другому
+	void setLoadSettings(const LoadTracker::Settings& settings)
+	{
+		load_settings = settings;
+	}
+
+	// запросы в секунду по хранилищам и самые нагруженные ключи
+	LoadTracker::Statistics getLoadStatistics()
+	{
+		return load_tracker.getStatistics();
+	}
+
+	// сколько диапазонов переносить одновременно и по сколько записей; действует со следующей ребалансировки
+	void setMigrationSettings(const Migration::Settings& settings)
+	{
+		migration_settings = settings;
+	}
+
+	// сколько запросов клиентов может ждать отправки у каждого хранилища, всего и от одного клиента;
+	// сверх этого клиент получает RETRY_LATER. Вызывается между проходами
+	void setQueueLimits(size_t queueLimit, size_t clientQueueLimit)
+	{
+		queue_limit = std::max<size_t>(queueLimit, 1);
+		client_queue_limit = std::max<size_t>(std::min(clientQueueLimit, queue_limit), 1);
+	}
+
+	// срок запросов клиентов, которые пришли без своего (кадр без FLAG_DEADLINE); 0 - такие запросы ждут
+	// сколько угодно. Вызывается между проходами
+	void setRequestTimeout(std::chrono::milliseconds timeout)
+	{
+		request_timeout = timeout;
+	}
+
+	// запросы, набравшиеся у хранилища за проход, уходят ему кадрами PACKED не длиннее bytesLimit;
+	// 0 - каждый запрос отдельным кадром. Вызывается между проходами
+	void setStoragePackLimit(size_t bytesLimit)
+	{
+		pack_bytes_limit = bytesLimit;
+	}
+
+	// сколько запросов держать в работе у хранилища с номером storageIndex (в том числе ещё не подключённого)
+	// вызывается между проходами
+	void setStorageDepth(size_t storageIndex, size_t depth)
+	{
+		storage_depths[storageIndex] = depth;
+		if (storageIndex < storages.size())
+			storages[storageIndex].depth = storageDepth(storageIndex, *storages[storageIndex].connection);
 	}
 
 	void process() override
 	{
+		events_seen = events->sequence();
 		logger.process();
+		expireRequests();
 
 		// clients get connection
-		if ((SharedObject::getStatusCode(connection->receiveMessage()) != this_status_code))
+		// ответ уходит в ящик, имя которого пришло в запросе
+		while (connection->hasMessage(this_status_code))
 		{
-			SharedObject request = SharedObject::deserialize(connection->receiveMessage());
+			SharedObject request = SharedObject::deserialize(connection->receiveMessage(), connection->receiveSize());
+			connection->popMessage();
+			auto replyName = request.getData();
+			if (!replyName)
+				continue;
+			std::unique_ptr<MemoryConnection> reply;
+			try
+			{ reply = std::make_unique<MemoryConnection>(false, replyName.value()); }
+			catch (...)
+			{
+				continue; // запросивший процесс уже завершился
+			}
 			switch (request.getRequestResponseCode())
 			{
 			case SharedObject::GET_CONNECTION_CLIENT:
 			{
-				std::string connection_name = "client" + std::to_string(client_id);
-				clients.push_back(std::make_shared<MemoryConnection>(true, connection_name));
-				clients.back()->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
-						SharedObject::NULL_DATA));
-				client_id++;
-				connection->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
+				if (client_pool.empty())
+					refillPools(1);
+				clients.push_back({ client_pool.front(), std::make_shared<SynchronizedConnection>(client_pool.front()) });
+				client_pool.pop_front();
+				std::string connection_name = clients.back().ring->getName();
+				reply->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
 						connection_name));
 
 				std::stringstream log;
@@ -98,13 +539,15 @@ public:
 			}
 			case SharedObject::GET_CONNECTION_STORAGE:
 			{
-				std::string connection_name = "storage" + std::to_string(storage_id);
+				if (storage_pool.empty())
+					refillPools(0);
+				std::string connection_name = storage_pool.front()->getName();
 				storages.emplace_back();
-				storages.back().connection = std::make_unique<MemoryConnection>(true, connection_name);
-				storages.back().client_requested = nullptr;
-				storages.back().clients_to_process = {};
-				storage_id++;
-				connection->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
+				storages.back().connection = std::move(storage_pool.front());
+				storages.back().depth = storageDepth(storages.size() - 1, *storages.back().connection);
+				addToRing(storages.size() - 1);
+				storage_pool.pop_front();
+				reply->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
 						connection_name));
 				need_to_create_rebalance_request = true;
 
@@ -116,160 +559,1305 @@ public:
 			}
 			default:
 			{
-				connection->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::ERROR,
+				reply->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::ERROR,
 						SharedObject::NULL_DATA));
 			}
 			}
 		}
 
-		// processing requests from clients
-		for (auto it = clients.begin(); it != clients.end();)
+		refillPools(POOL_REFILL_PER_TICK);
+		processSockets();
+		flushOutbound();
+
+		// rebalance storages
+		// запросы идут по текущему размещению, пока диапазоны, сменившие владельца, переносятся по одному
+		if (migration && migration->finished())
+		{
+			placement = migration->getPlan().getTo();
+			placement_replicas = migration->getPlan().getToReplicas();
+			std::stringstream log;
+			log << "[SERVER] Rebalance ended: " << migration->getPrint() << std::endl;
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::debug);
+			migration = nullptr;
+		}
+		load_tracker.resize(storages.size());
+		auto hot = load_tracker.checkHot(load_settings);
+		if (hot && !migration && !need_to_create_rebalance_request && load_settings.split_hot_ranges)
+			splitHotRange(hot.value());
+		if (!migration && need_to_create_rebalance_request)
+		{
+			size_t storages_count = storages.size();
+			migration = std::make_unique<Migration>(MigrationPlan(placement, placement_replicas, ring,
+					replication_factor), migration_settings);
+			// хранилища собирают из сообщения тот же план и запоминают, какие ключи им отдавать
+			// план встаёт в обычные очереди после уже отправленных запросов и раньше запросов этого прохода,
+			// так что записи хранилища учтут все
+			rebalance_announcement = std::make_shared<ScatterGatherRequest>(nullptr, SharedObject::Frame(
+					this_status_code, SharedObject::RequestResponseCode::STORAGE_REBALANCE,
+					migration->getPlan()).serialize(), storages_count, std::make_unique<AllOkReducer>());
+			for (auto& storage: storages)
+			{
+				storage.push(rebalance_announcement);
+			}
+			need_to_create_rebalance_request = false;
+
+			std::stringstream log;
+			log << "[SERVER] Rebalance started with storages count " << storages_count << ", ranges to move "
+				<< migration->getPlan().getRanges().size() << std::endl;
+			std::cout << log.str() << std::endl;
+			logger.log(log.str(), logger::severity::debug);
+		}
+		if (migration)
 		{
-			Connection* client_connection = it->get();
-			if (SharedObject::getStatusCode(client_connection->receiveMessage()) != this_status_code)
+			for (size_t range: migration->startRanges())
 			{
-				SharedObject message = SharedObject::deserialize(client_connection->receiveMessage());
+				startMigrationBatch(range);
+			}
+		}
 
-				std::stringstream log;
-				log << "[SERVER] Client '" << client_connection->getName() << "' request:" << std::endl
-					<< message.getPrint();
-				std::cout << log.str();
-				logger.log(log.str(), logger::severity::debug);
+		// пул простаивает, поэтому поля хранилищ можно читать без блокировок
+		for (auto& storage: storages)
+		{
+			if (!storage.in_flight.empty() || storage.hasQueued()
+				|| !storage.priority_to_process.empty() || storage.hasInbox())
+				scheduleStorage(storage);
+		}
 
-				if (message.getRequestResponseCode() == SharedObject::RequestResponseCode::CLOSE_CONNECTION)
-				{
-					it = clients.erase(it);
-					continue;
-				}
-				auto dataOpt = message.getData();
-				switch (message.getRequestResponseCode())
-				{
-				case SharedObject::RequestResponseCode::REQUEST:
-				{
-					if (storages.empty())
-					{
-						it++;
-						continue;
-					}
-					if (!dataOpt)
-					{
-						client_connection->sendMessage(SharedObject(this_status_code,
-								SharedObject::RequestResponseCode::ERROR,
-								SharedObject::NULL_DATA));
-						it++;
-						continue;
-					}
-					auto request = RequestObject<ContestInfo>::deserialize(dataOpt.value());
-					if (request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_DATABASE
-						|| request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_SCHEMA
-						|| request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_TABLE)
-					{
-						auto multipleRequest = std::make_shared<MultipleRequest>(std::move(*it), storages.size());
-						for (auto& storage: storages)
-						{
-							storage.clients_to_process.push(multipleRequest);
-						}
-						it = clients.erase(it);
-						continue;
-					}
+		// processing requests from clients
+		std::vector<char> closed(clients.size());
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			workers.submit([this, &closed, i]
+			{ closed[i] = processClient(clients[i].synchronized); });
+		}
+		std::vector<char> socket_closed(ready_socket_clients.size());
+		for (size_t i = 0; i < ready_socket_clients.size(); i++)
+		{
+			workers.submit([this, &socket_closed, i]
+			{ socket_closed[i] = processClient(socket_clients.at(ready_socket_clients[i]).synchronized); });
+		}
+		workers.waitIdle();
 
-					auto contestInfo = ContestInfo::deserialize(request.getData());
-					auto& storage = storages.at(contestInfo.hashcode() % storages.size());
-					storage.clients_to_process.push(*it);
-					it = clients.erase(it);
-					continue;
-				}
-				default:
-				{
-					client_connection->sendMessage(SharedObject(this_status_code,
-							SharedObject::RequestResponseCode::ERROR,
-							SharedObject::NULL_DATA));
-				}
-				}
-			}
-			it++;
+		finishRingClients(closed);
+		finishSocketClients(socket_closed);
+	}
+
+private:
+
+	// номер хранилища - его индекс в storages, поэтому сегменты хранилищ выдаются строго по порядку имён
+	void refillPools(size_t clientCount)
+	{
+		for (size_t i = 0; i < clientCount && client_pool.size() < CLIENT_POOL_SIZE; i++)
+		{
+			auto client = std::make_shared<RingConnection>(true, "client" + std::to_string(client_id),
+					CLIENT_SLOT_COUNT, CLIENT_SLOT_SIZE, true);
+			client->prefault();
+			client->setReceiveEvent(*events);
+			client_pool.push_back(client);
+			client_id++;
+		}
+		while (storage_pool.size() < STORAGE_POOL_SIZE)
+		{
+			std::string name = "storage" + std::to_string(storages.size() + storage_pool.size());
+			storage_pool.push_back(std::make_unique<RingConnection>(true, name, STORAGE_SLOT_COUNT,
+					STORAGE_SLOT_SIZE));
+			storage_pool.back()->prefault();
+			storage_pool.back()->setReceiveEvent(*events);
 		}
+	}
 
-		for (auto& storage: storages)
+	void processSockets()
+	{
+		if (!epoll)
+			return;
+		for (int descriptor: epoll->takeReady())
 		{
-			if (storage.client_requested == nullptr && !storage.clients_to_process.empty())
-			{
-				storage.client_requested = storage.clients_to_process.front();
-				storage.clients_to_process.pop();
-				auto sharedObj = SharedObject::deserialize(storage.client_requested->receiveMessage());
-				sharedObj.setStatusCode(this_status_code);
-				storage.connection->sendMessage(sharedObj);
-			}
+			ready_sockets.insert(descriptor);
+		}
 
-			if (storage.client_requested != nullptr)
+		for (auto it = ready_sockets.begin(); it != ready_sockets.end();)
+		{
+			int descriptor = *it;
+			bool drained = true;
+			if (descriptor == listener->getDescriptor())
 			{
-				if (SharedObject::getStatusCode(storage.connection->receiveMessage()) == this_status_code)
+				while (auto socket = listener->accept())
 				{
-					continue;
+					epoll->watch(socket->getDescriptor());
+					socket_handshakes.emplace(socket->getDescriptor(), std::move(socket));
 				}
-				auto message = SharedObject::deserialize(storage.connection->receiveMessage());
-				message.setStatusCode(this_status_code);
+				epoll->rearm(descriptor);
+			}
+			else if (socket_handshakes.count(descriptor))
+			{
+				processSocketHandshake(descriptor);
+			}
 
-				if (auto multipleRequest = std::dynamic_pointer_cast<MultipleRequest>(storage.client_requested))
-				{
-					bool status = message.getRequestResponseCode() == SharedObject::RequestResponseCode::OK;
-					if (multipleRequest->getResponse(status))
-					{
-						status = multipleRequest->getStatus();
-						auto client = multipleRequest->getConnection();
-						if (client == fake_connection_for_multiple_request_for_rebalance_storages)
-						{
-							rebalance_request_active = false;
+			// запросы и ответы могли прийти вместе с рукопожатием, поэтому проверяем сразу
+			// клиента разбирает задача пула, а решение о нём принимает finishSocketClients
+			if (socket_clients.count(descriptor))
+			{
+				ready_socket_clients.push_back(descriptor);
+				drained = false;
+			}
+			else if (socket_storages.count(descriptor))
+			{
+				// ответы хранилища читаются при обходе хранилищ, здесь только проверяем, живо ли соединение
+				auto storage = socket_storages.at(descriptor);
+				storage->hasMessage(this_status_code);
+				if (!storage->isClosed())
+					epoll->rearm(descriptor);
+			}
+			it = drained ? ready_sockets.erase(it) : ++it;
+		}
+	}
 
-							std::stringstream log;
-							log << "[SERVER] Rebalance ended" << std::endl;
-							std::cout << log.str();
-						}
-						else
-						{
-							client->sendMessage(SharedObject(this_status_code,
-									SharedObject::RequestResponseCode::OK,
-									status ? "true" : "false"));
-							clients.push_back(client);
-						}
+	// медленным читателям дописываем здесь, а не в потоках пула; кто так и не читает, отключится
+	void flushOutbound()
+	{
+		for (auto& client: clients)
+		{
+			if (client.ring->hasOutbound())
+				client.ring->flush();
+		}
+		for (auto& [descriptor, client]: socket_clients)
+		{
+			if (client.socket->hasOutbound())
+				client.socket->flush();
+		}
+		for (auto& [descriptor, storage]: socket_storages)
+		{
+			if (storage->hasOutbound())
+				storage->flush();
+		}
+	}
 
-						storage.client_requested = nullptr;
-					}
-					else
-					{
-						storage.client_requested = nullptr;
-					}
-				}
-				else
-				{
-					storage.client_requested->sendMessage(message);
-					clients.push_back(storage.client_requested);
-					storage.client_requested = nullptr;
-				}
+	bool hasOutbound() const
+	{
+		for (auto& client: clients)
+		{
+			if (client.ring->hasOutbound())
+				return true;
+		}
+		for (auto& [descriptor, client]: socket_clients)
+		{
+			if (client.socket->hasOutbound())
+				return true;
+		}
+		for (auto& [descriptor, storage]: socket_storages)
+		{
+			if (storage->hasOutbound())
+				return true;
+		}
+		return false;
+	}
+
+	// closed[i] - клиент clients[i] прислал CLOSE_CONNECTION; отключённые за то, что не читали ответы, тоже уходят
+	void finishRingClients(const std::vector<char>& closed)
+	{
+		for (size_t i = clients.size(); i > 0; i--)
+		{
+			auto& client = clients[i - 1];
+			if (!closed[i - 1] && !client.ring->isClosed())
+				continue;
+			if (!closed[i - 1])
+			{
+				std::stringstream log;
+				log << "[SERVER] Client '" << client.ring->getName() << "' disconnected: responses are not read"
+					<< std::endl;
+				std::cout << log.str();
+				logger.log(log.str(), logger::severity::warning);
+				std::lock_guard<std::mutex> lock(retry_mutex);
+				retry_from.erase(client.synchronized.get());
 			}
+			clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i - 1));
 		}
+	}
 
-		// rebalance storages
-		if (!rebalance_request_active && need_to_create_rebalance_request)
+	// closed[i] - клиент ready_socket_clients[i] прислал CLOSE_CONNECTION
+	void finishSocketClients(const std::vector<char>& closed)
+	{
+		for (size_t i = 0; i < ready_socket_clients.size(); i++)
 		{
-			size_t storages_count = storages.size();
-			std::string data = std::string(reinterpret_cast<const char* const>(&storages_count), sizeof(size_t));
-			fake_connection_for_multiple_request_for_rebalance_storages->sendMessage(SharedObject(this_status_code,
-					SharedObject::RequestResponseCode::STORAGE_REBALANCE, data));
-			auto multipleRequest = std::make_shared<MultipleRequest>
-					(fake_connection_for_multiple_request_for_rebalance_storages, storages_count);
-			for (auto& storage: storages)
+			int descriptor = ready_socket_clients[i];
+			auto& client = socket_clients.at(descriptor).socket;
+			if (closed[i] || client->isClosed())
+			{
+				std::stringstream log;
+				log << "[SERVER] Client '" << client->getName() << "' disconnected" << std::endl;
+				std::cout << log.str();
+				logger.log(log.str(), logger::severity::debug);
+				epoll->unwatch(descriptor);
+				socket_clients.erase(descriptor);
+				ready_sockets.erase(descriptor);
+			}
+			else if (!client->hasMessage(this_status_code))
 			{
-				storage.clients_to_process.push(multipleRequest);
+				epoll->rearm(descriptor);
+				ready_sockets.erase(descriptor);
 			}
+			// иначе хранилищ ещё нет и запросы ждут в буфере
+		}
+		ready_socket_clients.clear();
+	}
 
-			rebalance_request_active = true;
-			need_to_create_rebalance_request = false;
+	// первый кадр сокета - GET_CONNECTION_CLIENT или GET_CONNECTION_STORAGE, дальше по нему идут запросы
+	void processSocketHandshake(int descriptor)
+	{
+		auto& socket = socket_handshakes.at(descriptor);
+		if (!socket->hasMessage(this_status_code))
+		{
+			if (socket->isClosed())
+				socket_handshakes.erase(descriptor);
+			else
+				epoll->rearm(descriptor);
+			return;
+		}
 
+		SharedObject::RequestResponseCode code;
+		try
+		{
+			code = SharedObject::View(socket->receiveMessage(), socket->receiveSize()).getRequestResponseCode();
+		}
+		catch (const std::exception& e)
+		{
+			// кадр сошёлся по длине, но не по контрольной сумме - такому соединению не верим
 			std::stringstream log;
-			log << "[SERVER] Rebalance started with storages count " << storages_count << std::endl;
-			std::cout << log.str() << std::endl;
+			log << "[SERVER] Drop socket " << socket->getName() << ": " << e.what() << std::endl;
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::warning);
+			socket_handshakes.erase(descriptor);
+			return;
 		}
+		socket->popMessage();
+		switch (code)
+		{
+		case SharedObject::GET_CONNECTION_CLIENT:
+		{
+			std::string connection_name = "client" + std::to_string(client_id);
+			client_id++;
+			socket->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
+					connection_name));
+			std::shared_ptr<SocketConnection> client = std::move(socket);
+			socket_clients.emplace(descriptor, SocketClient{ client, std::make_shared<SynchronizedConnection>(client) });
+
+			std::stringstream log;
+			log << "[SERVER] Create client socket connection: " << connection_name << std::endl;
+			std::cout << log.str() << std::endl;
+			logger.log(log.str(), logger::severity::debug);
+			break;
+		}
+		case SharedObject::GET_CONNECTION_STORAGE:
+		{
+			std::string connection_name = "storage" + std::to_string(storages.size());
+			// номер занят сокетом, так что заготовленный под него сегмент не пригодится
+			if (!storage_pool.empty())
+				storage_pool.pop_front();
+			socket->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::OK,
+					connection_name));
+			socket_storages.emplace(descriptor, socket.get());
+			storages.emplace_back();
+			storages.back().connection = std::move(socket);
+			storages.back().depth = storageDepth(storages.size() - 1, *storages.back().connection);
+			addToRing(storages.size() - 1);
+			need_to_create_rebalance_request = true;
+
+			std::stringstream log;
+			log << "[SERVER] Create storage socket connection: " << connection_name << std::endl;
+			std::cout << log.str() << std::endl;
+			logger.log(log.str(), logger::severity::debug);
+			break;
+		}
+		default:
+		{
+			socket->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::ERROR,
+					SharedObject::NULL_DATA));
+			epoll->rearm(descriptor);
+			return;
+		}
+		}
+		socket_handshakes.erase(descriptor);
+	}
+
+	// запросы забираются из соединения сразу, так что у клиента может быть много запросов в работе
+	// true - клиент закрыл соединение
+	bool processClient(const std::shared_ptr<Connection>& client)
+	{
+		Connection* client_connection = client.get();
+		bool closed = false;
+		while (client_connection->hasMessage(this_status_code))
+		{
+			// кадр снимается только через pop: после ошибки надо знать, снят ли он
+			bool popped = false;
+			auto pop = [&]
+			{
+				client_connection->popMessage();
+				popped = true;
+			};
+			try
+			{
+				SharedObject::View message(client_connection->receiveMessage(), client_connection->receiveSize());
+
+				std::stringstream log;
+				log << "[SERVER] Client '" << client_connection->getName() << "' request:" << std::endl
+					<< message.getPrint();
+				std::cout << log.str();
+				logger.log(log.str(), logger::severity::debug);
+
+				if (message.getRequestResponseCode() == SharedObject::RequestResponseCode::CLOSE_CONNECTION)
+				{
+					pop();
+					closed = true;
+					std::lock_guard<std::mutex> lock(retry_mutex);
+					retry_from.erase(client_connection);
+					break;
+				}
+				if (message.getRequestResponseCode() != SharedObject::RequestResponseCode::REQUEST)
+				{
+					uint64_t correlationId = message.getCorrelationId();
+					pop();
+					client_connection->sendMessage(SharedObject::Frame(this_status_code,
+							SharedObject::RequestResponseCode::ERROR, SharedObject::NULL_DATA, correlationId));
+					continue;
+				}
+				if (storages.empty())
+				{
+					break;
+				}
+				auto dataOpt = message.getData();
+				if (!dataOpt)
+				{
+					uint64_t correlationId = message.getCorrelationId();
+					pop();
+					client_connection->sendMessage(SharedObject::Frame(this_status_code,
+							SharedObject::RequestResponseCode::ERROR, SharedObject::NULL_DATA, correlationId));
+					continue;
+				}
+				uint64_t correlationId = message.getCorrelationId();
+				if (!canAdmit(client_connection, correlationId))
+				{
+					pop();
+					retryLater(*client_connection, correlationId);
+					continue;
+				}
+
+				auto deadline = deadlineOf(message);
+				RequestObject<ContestInfo>::View request(dataOpt.value());
+				if (request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_DATABASE
+					|| request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_SCHEMA
+					|| request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::DELETE_TABLE)
+				{
+					if (in_flight_reads)
+						in_flight_reads->beginClear();
+					auto gather = std::make_shared<ScatterGatherRequest>(client, storages.size(),
+							std::make_unique<AnyOkReducer>());
+					gather->setDeadline(deadline);
+					broadcast(gather);
+					timer_wheel.add(gather);
+					pop();
+					if (read_cache)
+						read_cache->clear();
+					continue;
+				}
+				if (request.getRequestCode() == RequestObject<ContestInfo>::RequestCode::BATCH)
+				{
+					processBatch(client, request, correlationId, deadline);
+					pop();
+					continue;
+				}
+
+				// ключ записи клиент кладёт в заголовок; у клиентов, которые его не ставят, приходится разбирать запись
+				uint64_t keyHash = message.getRoutingKey();
+				if (keyHash == 0)
+					keyHash = ContestInfo::deserialize(std::string(request.getData())).hashcode();
+				auto code = request.getRequestCode();
+				std::shared_ptr<PendingRequest> pendingRequest;
+				std::shared_ptr<CachedRequest> read; // может стать общим для таких же чтений
+				uint64_t readEpoch = 0;
+				if ((read_cache || in_flight_reads) && (ReadCache::isRead(code) || ReadCache::isWrite(code)))
+				{
+					std::string key = ReadCache::makeKey(request.getDatabase(), request.getSchema(), request.getTable(),
+							keyHash);
+					if (ReadCache::isRead(code))
+					{
+						auto cached = read_cache ? read_cache->get(key, code) : std::nullopt;
+						if (cached)
+						{
+							pop();
+							client_connection->sendMessage(SharedObject::Frame(this_status_code, cached->code,
+									cached->data, correlationId));
+							continue;
+						}
+						if (in_flight_reads && in_flight_reads->join(key, code, client, correlationId))
+						{
+							pop();
+							continue;
+						}
+						uint64_t epoch = read_cache ? read_cache->epoch(key) : 0;
+						readEpoch = in_flight_reads ? in_flight_reads->epoch(key) : 0;
+						read = std::make_shared<CachedRequest>(client, std::move(key), code, epoch);
+						pendingRequest = read;
+					}
+					else
+					{
+						if (read_cache)
+							read_cache->invalidate(key);
+						if (in_flight_reads)
+							in_flight_reads->beginWrite(key);
+						pendingRequest = std::make_shared<CachedRequest>(client, std::move(key), code);
+					}
+				}
+				else
+				{
+					pendingRequest = std::make_shared<PendingRequest>(client);
+				}
+				pop();
+				pendingRequest->setDeadline(deadline);
+				load_tracker.recordKey(keyHash);
+				auto replicas = route(keyHash, pendingRequest);
+				if (replicas && !dispatch(pendingRequest, replicas.value(), true))
+				{
+					reject(*client_connection, correlationId);
+					auto cached = std::dynamic_pointer_cast<CachedRequest>(pendingRequest);
+					if (cached && in_flight_reads && ReadCache::isWrite(code))
+						in_flight_reads->endWrite(cached->getCacheKey());
+					continue;
+				}
+				timer_wheel.add(pendingRequest);
+				if (read && in_flight_reads)
+					in_flight_reads->lead(read, readEpoch);
+			}
+			catch (const std::exception& e)
+			{
+				if (!dropBadFrame(*client_connection, popped, e))
+				{
+					closed = true;
+					break;
+				}
+			}
+		}
+		return closed;
+	}
+
+	// кадр, на котором споткнулась обработка, снимается, клиенту - ERROR с его номером;
+	// false - номер не прочитать, и с таким клиентом дальше не разговариваем
+	bool dropBadFrame(Connection& client, bool popped, const std::exception& error)
+	{
+		std::stringstream log;
+		log << "[SERVER] Bad request from '" << client.getName() << "': " << error.what() << std::endl;
+		std::cout << log.str();
+		logger.log(log.str(), logger::severity::warning);
+		// снятый кадр уже отдан дальше, ответ на него придёт своим путём или TIMEOUT
+		if (popped)
+			return true;
+		std::optional<uint64_t> correlationId;
+		try
+		{
+			correlationId = SharedObject::View(client.receiveMessage(), client.receiveSize(), false).getCorrelationId();
+		}
+		catch (const std::exception&)
+		{
+		}
+		client.popMessage();
+		if (!correlationId)
+			return false;
+		client.sendMessage(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+				SharedObject::NULL_DATA, correlationId.value()));
+		return true;
+	}
+
+	// срок из кадра клиента, иначе request_timeout от приёма
+	std::chrono::steady_clock::time_point deadlineOf(const SharedObject::View& message) const
+	{
+		auto timeout = message.getTimeout();
+		if (!timeout && request_timeout.count() == 0)
+			return std::chrono::steady_clock::time_point::max();
+		return std::chrono::steady_clock::now() + timeout.value_or(request_timeout);
+	}
+
+	// клиентам, чей срок наступил, - TIMEOUT; сами запросы выбросит хранилище, когда до них дойдёт очередь,
+	// а ответы на уже отправленные разбираются как обычно, но клиенту не уходят
+	void expireRequests()
+	{
+		for (const auto& request: timer_wheel.advance())
+			replyTimeout(*request);
+	}
+
+	void replyTimeout(PendingRequest& request)
+	{
+		if (!request.finish())
+			return;
+		request.replyTimeout(this_status_code);
+		timed_out++;
+	}
+
+	// срок запроса истёк, пока он ждал в очереди: хранилищу он не отправляется, клиент сразу получает TIMEOUT
+	// (колесо его уже не найдёт), учёт записей и чтений снимается так же, как при ответе.
+	// Записи репликам (у ReplicatedRequest срока нет) и запросы ко всем хранилищам уходят и после срока -
+	// иначе реплики разойдутся, а DELETE_* не закончится
+	bool dropExpired(Storage& storage, const std::shared_ptr<PendingRequest>& request,
+			std::chrono::steady_clock::time_point now)
+	{
+		if (!request->isExpired(now) || std::dynamic_pointer_cast<ScatterGatherRequest>(request))
+			return false;
+		dropRequest(storage, request);
+		storage.expired++;
+		return true;
+	}
+
+	// запрос, на который это хранилище уже не ответит: клиенту - TIMEOUT, учёт записей и чтений снимается как при ERROR.
+	// Реплика записи, запрос ко всем хранилищам и шаг переноса ждут и других хранилищ, поэтому выпавшее
+	// считается ответившим ERROR и запрос завершается как при ответе - иначе его счётчик ответов не сойдётся
+	void dropRequest(Storage& storage, const std::shared_ptr<PendingRequest>& request)
+	{
+		std::string frame = SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+				SharedObject::NULL_DATA).serialize();
+		SharedObject::View error(frame.data(), frame.size());
+		if (std::dynamic_pointer_cast<ReplicatedRequest>(request)
+			|| std::dynamic_pointer_cast<ScatterGatherRequest>(request)
+			|| std::dynamic_pointer_cast<MigrationRequest>(request))
+		{
+			completeRequest(request, error);
+		}
+		else if (auto part = std::dynamic_pointer_cast<BatchPart>(request))
+		{
+			replyTimeout(*part->getBatch());
+			endWrites(*part);
+		}
+		else
+		{
+			replyTimeout(*request);
+			completeKeyRequest(request, error);
+		}
+		storage.load--;
+	}
+
+	// выведенное из работы хранилище: всё, что к нему ушло и ещё не ушло, снимается
+	void dropQueued(Storage& storage)
+	{
+		for (auto& [linkId, request]: storage.in_flight)
+		{
+			dropRequest(storage, request);
+		}
+		storage.in_flight.clear();
+		storage.outgoing.clear();
+		storage.takeInbox();
+		for (auto& queued: storage.priority_to_process)
+		{
+			dropRequest(storage, queued.request);
+		}
+		storage.priority_to_process.clear();
+		while (storage.hasQueued())
+		{
+			dropRequest(storage, storage.takeQueued());
+		}
+	}
+
+	// после отклонения запросы клиента принимаются снова, начиная с повтора отклонённого
+	bool canAdmit(const Connection* client, uint64_t correlationId)
+	{
+		std::lock_guard<std::mutex> lock(retry_mutex);
+		auto rejected = retry_from.find(client);
+		if (rejected == retry_from.end())
+			return true;
+		if (rejected->second != correlationId)
+			return false;
+		retry_from.erase(rejected);
+		return true;
+	}
+
+	void retryLater(const Connection& client, uint64_t correlationId)
+	{
+		client.sendMessage(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::RETRY_LATER,
+				SharedObject::NULL_DATA, correlationId));
+	}
+
+	// запрос не принят хранилищем: следующие запросы клиента ждут его повтора
+	void reject(const Connection& client, uint64_t correlationId)
+	{
+		{
+			std::lock_guard<std::mutex> lock(retry_mutex);
+			retry_from[&client] = correlationId;
+		}
+		retryLater(client, correlationId);
+	}
+
+	/*
+	 Пачка делится на части по хранилищам ключей (реплики - как у одиночных запросов), каждая часть -
+	 пачка в том же формате со своими операциями в исходном порядке. Части к переносимым диапазонам
+	 откладываются до конца переноса. Принять пачку решает хранилище первой не отложенной части:
+	 если его очередь полна, RETRY_LATER получает вся пачка, остальные части встают без ограничения.
+	 */
+	void processBatch(const std::shared_ptr<Connection>& client, const RequestObject<ContestInfo>::View& request,
+			uint64_t correlationId, std::chrono::steady_clock::time_point deadline)
+	{
+		struct Part
+		{
+			std::vector<Batch::Operation> operations;
+			std::vector<size_t> positions;
+			std::vector<std::string> written_keys;
+			bool read_only = true;
+		};
+
+		// (переносимый диапазон, хранилища) -> часть
+		std::map<std::pair<size_t, std::vector<size_t>>, Part> parts;
+		std::vector<Batch::Operation> operations;
+		try
+		{
+			operations = Batch::decode(request.getData());
+			for (size_t i = 0; i < operations.size(); i++)
+			{
+				auto& operation = operations[i];
+				if (!Batch::isKeyOperation(operation.code))
+					throw std::runtime_error("Unsupported batch operation");
+				if (operation.key_hash == 0)
+					operation.key_hash = ContestInfo::deserialize(std::string(operation.data)).hashcode();
+				auto target = locate(operation.key_hash);
+				Part& part = parts[{ target.moving_range, std::move(target.owners) }];
+				part.operations.push_back(operation);
+				part.positions.push_back(i);
+				if (ReadCache::isWrite(operation.code))
+				{
+					part.read_only = false;
+					if (read_cache || in_flight_reads)
+						part.written_keys.push_back(ReadCache::makeKey(request.getDatabase(), request.getSchema(),
+								request.getTable(), operation.key_hash));
+				}
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::stringstream log;
+			log << "[SERVER] Malformed batch from '" << client->getName() << "': " << e.what() << std::endl;
+			logger.log(log.str(), logger::severity::warning);
+			client->sendMessage(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+					SharedObject::NULL_DATA, correlationId));
+			return;
+		}
+		if (parts.empty())
+		{
+			client->sendMessage(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::OK,
+					Batch::encodeResults({}), correlationId));
+			return;
+		}
+
+		auto batch = std::make_shared<BatchRequest>(client, correlationId, operations.size(),
+				static_cast<int>(parts.size()));
+		batch->setDeadline(deadline);
+		std::string database(request.getDatabase());
+		std::string schema(request.getSchema());
+		std::string table(request.getTable());
+		std::vector<std::pair<std::shared_ptr<BatchPart>, std::vector<size_t>>> ready; // часть и её хранилища
+		std::vector<std::pair<std::shared_ptr<BatchPart>, uint64_t>> moving; // часть и ключ её первой операции
+		for (auto& [target, part]: parts)
+		{
+			std::string message = SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::REQUEST,
+					RequestObject<ContestInfo>(RequestObject<ContestInfo>::RequestCode::BATCH,
+							Batch::encode(part.operations), database, schema, table)).serialize();
+			for (const auto& operation: part.operations)
+				load_tracker.recordKey(operation.key_hash);
+			for (const auto& key: part.written_keys)
+			{
+				if (read_cache)
+					read_cache->invalidate(key);
+				if (in_flight_reads)
+					in_flight_reads->beginWrite(key);
+			}
+			auto batchPart = std::make_shared<BatchPart>(batch, std::move(message), std::move(part.positions),
+					std::move(part.written_keys), part.read_only);
+			if (target.first == MigrationPlan::NONE)
+				ready.emplace_back(std::move(batchPart), target.second);
+			else
+				moving.emplace_back(std::move(batchPart), part.operations.front().key_hash);
+		}
+
+		bool admitted = false;
+		for (const auto& [part, replicas]: ready)
+		{
+			if (!dispatch(part, replicas, !admitted))
+			{
+				// не принята только первая часть, так что не отправлено ничего
+				for (const auto& [notSent, notSentReplicas]: ready)
+					endWrites(*notSent);
+				for (const auto& [notSent, key]: moving)
+					endWrites(*notSent);
+				reject(*client, correlationId);
+				return;
+			}
+			admitted = true;
+		}
+		for (const auto& [part, key]: moving)
+		{
+			// диапазон мог успеть переехать
+			auto replicas = route(key, part);
+			if (replicas)
+				dispatch(part, replicas.value(), false);
+		}
+		timer_wheel.add(batch);
+	}
+
+	void endWrites(const BatchPart& part)
+	{
+		for (const auto& key: part.getWrittenKeys())
+		{
+			if (read_cache)
+				read_cache->invalidate(key);
+			if (in_flight_reads)
+				in_flight_reads->endWrite(key);
+		}
+	}
+
+	// ответ хранилища (или выбранный ответ реплик) на часть пачки
+	void completeBatchPart(const BatchPart& part, int code, std::string_view data)
+	{
+		if (part.getBatch()->getResponse(part.getPositions(), code, data) && part.getBatch()->finish())
+			part.getBatch()->reply(this_status_code);
+		endWrites(part);
+	}
+
+	// отдаёт хранилище пулу, если им сейчас не занят другой поток
+	void scheduleStorage(Storage& storage)
+	{
+		if (!storage.scheduled.exchange(true))
+			workers.submit([this, &storage]
+			{ processStorage(storage); });
+	}
+
+	// хранилища с ключом; nullopt - ключ переезжает, запрос отправится, когда перенос его диапазона закончится
+	std::optional<std::vector<size_t>> route(uint64_t keyHash, const std::shared_ptr<PendingRequest>& request)
+	{
+		if (migration)
+			return migration->route(keyHash, request);
+		return placement.nodesFor(keyHash, placement_replicas);
+	}
+
+	// как route, но ничего не откладывает
+	Migration::Target locate(uint64_t keyHash)
+	{
+		if (migration)
+			return migration->locate(keyHash);
+		return { placement.nodesFor(keyHash, placement_replicas) };
+	}
+
+	// чтение (и часть пачки только из чтений) - одной реплике, у которой меньше всего запросов, запись - всем
+	// bounded - запрос можно не принять, если очередь хранилища полна (для записи решает основная реплика);
+	// false - не принят
+	bool dispatch(const std::shared_ptr<PendingRequest>& request, const std::vector<size_t>& replicas, bool bounded)
+	{
+		if (replicas.size() == 1)
+			return enqueue(replicas.front(), request, bounded);
+
+		SharedObject::View message(request->receiveMessage(), request->receiveSize(), false);
+		auto code = RequestObject<ContestInfo>::View(message.getRawData()).getRequestCode();
+		auto batchPart = std::dynamic_pointer_cast<BatchPart>(request);
+		if (ReadCache::isRead(code) || (batchPart && batchPart->isReadOnly()))
+		{
+			// при равной нагрузке - основная реплика, она первая
+			size_t best = replicas.front();
+			for (size_t replica: replicas)
+			{
+				if (storages.at(replica).load < storages.at(best).load)
+					best = replica;
+			}
+			return enqueue(best, request, bounded);
+		}
+
+		auto replicated = std::make_shared<ReplicatedRequest>(request, static_cast<int>(replicas.size()));
+		if (!enqueue(replicas.front(), replicated, bounded))
+			return false;
+		for (size_t i = 1; i < replicas.size(); i++)
+		{
+			enqueue(replicas[i], replicated, false);
+		}
+		return true;
+	}
+
+	bool enqueue(size_t storageIndex, const std::shared_ptr<PendingRequest>& request, bool bounded)
+	{
+		auto& storage = storages.at(storageIndex);
+		if (!bounded)
+			storage.push(request);
+		else if (!storage.tryPush(request, queue_limit, client_queue_limit))
+			return false;
+		load_tracker.recordStorage(storageIndex);
+		scheduleStorage(storage);
+		return true;
+	}
+
+	// шаг переноса источнику диапазона (основному старому владельцу): | varint диапазон | ... |
+	void pushToSource(size_t range, MigrationRequest::Stage stage, std::string_view data, bool last = false)
+	{
+		auto& storage = storages.at(migration->getPlan().getRanges()[range].source());
+		storage.push(std::make_shared<MigrationRequest>(this_status_code, stage, range,
+				migration->getAttempt(range), data, last));
+		scheduleStorage(storage);
+	}
+
+	static std::string encodeRange(size_t range)
+	{
+		std::string data(WireFormat::MAX_VARINT_SIZE, '\0');
+		data.resize(WireFormat::writeVarint(&data[0], range) - data.data());
+		return data;
+	}
+
+	// просит старого владельца диапазона отдать следующую пачку
+	void startMigrationBatch(size_t range)
+	{
+		std::string data(2 * WireFormat::MAX_VARINT_SIZE, '\0');
+		char* end = WireFormat::writeVarint(&data[0], range);
+		end = WireFormat::writeVarint(end, migration->getBatchRecords());
+		data.resize(end - data.data());
+		pushToSource(range, MigrationRequest::OUT, data);
+	}
+
+	// пачку приняли все новые владельцы: старый может удалить её записи
+	void commitMigrationBatch(size_t range, bool last)
+	{
+		pushToSource(range, MigrationRequest::COMMIT, encodeRange(range), last);
+	}
+
+	// отложенные запросы диапазона уходят новым владельцам, главный поток может начинать следующий диапазон
+	void finishMigrationRange(size_t range)
+	{
+		const auto& owners = migration->getPlan().getRanges()[range].to;
+		for (auto& request: migration->finishRange(range))
+		{
+			dispatch(request, owners, false);
+		}
+		events->notify();
+	}
+
+	// шаг не удался: источник возвращает пачку в очередь на перенос и снова обслуживает диапазон,
+	// перенос повторит главный поток (startRanges)
+	void abortMigrationRange(size_t range)
+	{
+		pushToSource(range, MigrationRequest::ABORT, encodeRange(range));
+		if (!migration->canRetry(range))
+		{
+			std::stringstream log;
+			log << "[SERVER] Migration of range " << range << " gave up, its records stay at the source" << std::endl;
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::error);
+			finishMigrationRange(range);
+			return;
+		}
+		const size_t source = migration->getPlan().getRanges()[range].source();
+		for (auto& request: migration->retryRange(range))
+		{
+			dispatch(request, { source }, false);
+		}
+		events->notify();
+	}
+
+	// ответ хранилища на шаг переноса; выполняется потоком, владеющим этим хранилищем
+	void processMigrationResponse(const MigrationRequest& request, const SharedObject::View& message)
+	{
+		size_t range = request.getRange();
+		if (!migration->isMoving(range, request.getAttempt()))
+			return;
+		if (message.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
+		{
+			std::stringstream log;
+			log << "[SERVER] Migration of range " << range << " failed, will retry:" << message.getPrint();
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::error);
+			abortMigrationRange(range);
+			return;
+		}
+		switch (request.getStage())
+		{
+		case MigrationRequest::IN:
+			if (migration->ack(range))
+				commitMigrationBatch(range, request.isLast());
+			return;
+		case MigrationRequest::COMMIT:
+			if (request.isLast())
+				finishMigrationRange(range);
+			else
+				startMigrationBatch(range);
+			return;
+		case MigrationRequest::ABORT:
+			return; // ABORT уходит, когда попытка уже прервана
+		default:
+			break;
+		}
+
+		// | varint осталось записей | varint записей в пачке | записи |, новому владельцу уходит как есть
+		std::string_view batch = message.getRawData();
+		const char* ptr = batch.data();
+		const char* end = ptr + batch.size();
+		uint64_t remaining;
+		uint64_t count;
+		if (!WireFormat::readVarint(ptr, end, remaining) || !WireFormat::readVarint(ptr, end, count))
+		{
+			std::stringstream log;
+			log << "[SERVER] Migration of range " << range << " got a malformed batch, will retry" << std::endl;
+			std::cout << log.str();
+			logger.log(log.str(), logger::severity::error);
+			abortMigrationRange(range);
+			return;
+		}
+		auto targets = migration->getPlan().getRanges()[range].targets();
+		if (count == 0 || targets.empty())
+		{
+			// новым владельцам нечего отдавать, источник только удаляет свою копию
+			migration->addMovedRecords(count);
+			commitMigrationBatch(range, remaining == 0);
+			return;
+		}
+		// одна пачка на всех новых владельцев
+		auto batchRequest = std::make_shared<MigrationRequest>(this_status_code, MigrationRequest::IN, range,
+				request.getAttempt(), batch, remaining == 0);
+		migration->expectAcks(range, targets.size(), count);
+		for (size_t target: targets)
+		{
+			auto& storage = storages.at(target);
+			storage.push(batchRequest);
+			scheduleStorage(storage);
+		}
+	}
+
+	// ответ на запрос к записи, уже отправленный клиенту: кэш, присоединившиеся чтения, учёт записей
+	void completeKeyRequest(const std::shared_ptr<PendingRequest>& request, const SharedObject::View& response)
+	{
+		auto cached = std::dynamic_pointer_cast<CachedRequest>(request);
+		if (!cached)
+			return;
+		updateReadCache(*cached, response);
+		if (ReadCache::isWrite(cached->getRequestCode()))
+		{
+			if (in_flight_reads)
+				in_flight_reads->endWrite(cached->getCacheKey());
+			return;
+		}
+		if (in_flight_reads)
+			in_flight_reads->finish(cached);
+		if (response.getRequestResponseCode() == SharedObject::RequestResponseCode::ERROR)
+			cached->retryFollowers(this_status_code);
+		else
+			cached->replyFollowers(this_status_code, response);
+	}
+
+	// ответ на чтение запоминается, запись ещё раз удаляет ключ: чтения, прошедшие до неё, кэш уже не примет.
+	// Запоминается только OK: его хранилище даёт, лишь проверив ключ маршрутизации клиента по самой записи
+	void updateReadCache(const CachedRequest& cached, const SharedObject::View& response)
+	{
+		if (!read_cache)
+			return;
+		if (ReadCache::isWrite(cached.getRequestCode()))
+			read_cache->invalidate(cached.getCacheKey());
+		else if (response.getRequestResponseCode() == SharedObject::RequestResponseCode::OK)
+			read_cache->put(cached.getCacheKey(), cached.getRequestCode(),
+					{ response.getRequestResponseCode(), std::string(response.getRawData()) },
+					cached.getCacheEpoch());
+	}
+
+	// часть дуги перегруженного хранилища с его самыми нагруженными ключами отдаётся наименее нагруженному:
+	// точка разбиения ставится за последним ключом, который ещё помещается в половину разницы их нагрузок,
+	// и ключи переносит обычная ребалансировка. Вызывается между проходами, когда переезда нет
+	void splitHotRange(size_t hot)
+	{
+		std::vector<double> rates = load_tracker.getStorageRates();
+		std::optional<size_t> cold;
+		for (size_t storage = 0; storage < rates.size(); storage++)
+		{
+			if (storage != hot && ring.getVirtualNodes(storage) && (!cold || rates[storage] < rates[cold.value()]))
+				cold = storage;
+		}
+		if (!cold || ring.getSplits().size() >= load_settings.max_splits)
+			return;
+		double budget = (rates[hot] - rates[cold.value()]) / 2;
+
+		// ключи перегруженного хранилища по дугам; внутри дуги - по удалению от её начала
+		std::map<uint64_t, std::vector<std::pair<uint64_t, double>>> arcs;
+		for (const auto& key: load_tracker.getKeys())
+		{
+			uint64_t position = ConsistentHashRing::positionOf(key.key_hash);
+			if (ring.ownerOf(position) == hot)
+				arcs[ring.arcOf(position).first].emplace_back(position, key.rate);
+		}
+		double moved = 0;
+		uint64_t split = 0;
+		for (auto& [begin, keys]: arcs)
+		{
+			std::sort(keys.begin(), keys.end(), [begin = begin](const auto& a, const auto& b)
+			{ return a.first - begin < b.first - begin; });
+			double prefix = 0;
+			for (const auto& [position, rate]: keys)
+			{
+				if (prefix + rate > budget)
+					break;
+				prefix += rate;
+				if (prefix > moved)
+				{
+					moved = prefix;
+					split = position;
+				}
+			}
+		}
+
+		std::stringstream log;
+		if (moved == 0)
+		{
+			// один ключ горячее половины разницы: перенос только сделал бы перегруженным другое хранилище
+			log << "[SERVER] Storage " << hot << " is overloaded (" << rates[hot]
+				<< " requests/s), but its hottest key cannot be split" << std::endl;
+		}
+		else
+		{
+			ring.addSplit(split, cold.value());
+			need_to_create_rebalance_request = true;
+			log << "[SERVER] Storage " << hot << " is overloaded (" << rates[hot] << " requests/s), keys with "
+				<< moved << " requests/s move to storage " << cold.value() << " (" << rates[cold.value()]
+				<< " requests/s)" << std::endl;
+			std::cout << log.str();
+		}
+		logger.log(log.str(), logger::severity::debug);
+		load_tracker.reset();
+	}
+
+	void addToRing(size_t storageIndex)
+	{
+		auto configured = storage_virtual_nodes.find(storageIndex);
+		ring.addNode(storageIndex, configured != storage_virtual_nodes.end()
+								   ? configured->second : ConsistentHashRing::DEFAULT_VIRTUAL_NODES);
+	}
+
+	// заданная глубина, но не больше половины соединения: остальное место - под ответы.
+	// Глубина считает кадры, а большой кадр (часть пачки, длинная запись) занимает несколько слотов,
+	// поэтому в заполненное кольцо sendOutgoing не пишет вовсе
+	size_t storageDepth(size_t storageIndex, const Connection& storageConnection) const
+	{
+		auto configured = storage_depths.find(storageIndex);
+		size_t depth = configured != storage_depths.end() ? configured->second : default_storage_depth;
+		return std::max<size_t>(1, std::min(depth, storageConnection.capacity() / 2));
+	}
+
+	// запрос ко всем хранилищам сразу по приоритетной полосе; ответы сведёт reducer запроса
+	// запрос обгоняет обычные очереди хранилищ, кроме запросов того же клиента
+	void broadcast(const std::shared_ptr<ScatterGatherRequest>& request)
+	{
+		for (auto& storage: storages)
+		{
+			storage.push(request, true);
+			scheduleStorage(storage);
+		}
+	}
+
+	// выполняется только потоком, владеющим хранилищем; запрос уходит в sendOutgoing
+	void forward(Storage& storage, std::shared_ptr<PendingRequest> request)
+	{
+		// номера клиентов могут совпадать, поэтому хранилищу уходит номер этого соединения
+		uint64_t linkId = storage.next_link_id++;
+		storage.in_flight.emplace(linkId, std::move(request));
+		storage.outgoing.push_back(linkId);
+		storage.forwarded++;
+		storage.peak_in_flight = std::max(storage.peak_in_flight, storage.in_flight.size());
+	}
+
+	// запросы, набранные за проход, уходят не по одному, а пачками: хранилище выполняет пачку за один проход
+	// и отвечает одним кадром, так что запись в кольцо и пробуждение приходятся на пачку.
+	// Пачка - только то, что уже ждало отправки, ради неё запросы не задерживаются.
+	// Что не помещается в кольцо, ждёт следующего прохода: ответы хранилища читает этот же поток,
+	// и, застряв в sendMessage, он оставил бы хранилище ждать места под ответ, а себя - места под запрос
+	void sendOutgoing(Storage& storage)
+	{
+		std::vector<SharedObject::Frame> frames;
+		frames.reserve(storage.outgoing.size());
+		auto now = std::chrono::steady_clock::now();
+		for (uint64_t linkId: storage.outgoing)
+		{
+			const auto& request = storage.in_flight.at(linkId);
+			frames.emplace_back(this_status_code, SharedObject::View(request->receiveMessage(), request->receiveSize(), false), linkId);
+			// хранилищу - сколько осталось до срока, чтобы оно не делало работу, ответ на которую уже не нужен
+			frames.back().withTimeout(request->getRemaining(now));
+		}
+
+		size_t sent = 0;
+		for (size_t begin = 0, end; begin < frames.size(); begin = end)
+		{
+			size_t bytes = 0;
+			for (end = begin; end < frames.size(); end++)
+			{
+				size_t frameBytes = WireFormat::MAX_VARINT_SIZE + frames[end].serializedSize();
+				if (end > begin && bytes + frameBytes > pack_bytes_limit)
+					break;
+				bytes += frameBytes;
+			}
+			if (end - begin == 1)
+			{
+				if (!storage.connection->canSend(frames[begin].serializedSize()))
+					break;
+				storage.connection->sendMessage(frames[begin]);
+				sent = end;
+				continue;
+			}
+			FramePack pack;
+			for (size_t i = begin; i < end; i++)
+				pack.add(frames[i]);
+			SharedObject::Frame packed(this_status_code, SharedObject::RequestResponseCode::PACKED, pack.getData());
+			if (!storage.connection->canSend(packed.serializedSize()))
+				break;
+			storage.connection->sendMessage(packed);
+			storage.packs++;
+			storage.packed += pack.size();
+			sent = end;
+		}
+		storage.outgoing.erase(storage.outgoing.begin(), storage.outgoing.begin() + static_cast<std::ptrdiff_t>(sent));
+	}
+
+	// выполняется только потоком, владеющим хранилищем
+	void processStorageResponse(Storage& storage, const SharedObject::View& message)
+	{
+		auto request = storage.in_flight.find(message.getCorrelationId());
+		if (request == storage.in_flight.end())
+		{
+			std::stringstream log;
+			log << "[SERVER] Unexpected response from " << storage.connection->getName() << ":"
+				<< message.getPrint();
+			logger.log(log.str(), logger::severity::warning);
+			return;
+		}
+
+		completeRequest(request->second, message);
+		storage.in_flight.erase(request);
+		storage.load--;
+	}
+
+	// ответ хранилища на запрос или, для выпавшего хранилища, ERROR вместо него (dropRequest)
+	void completeRequest(const std::shared_ptr<PendingRequest>& request, const SharedObject::View& message)
+	{
+		if (auto migrationRequest = std::dynamic_pointer_cast<MigrationRequest>(request))
+		{
+			processMigrationResponse(*migrationRequest, message);
+		}
+		else if (auto replicated = std::dynamic_pointer_cast<ReplicatedRequest>(request))
+		{
+			if (replicated->getResponse(message))
+			{
+				if (auto part = std::dynamic_pointer_cast<BatchPart>(replicated->getOrigin()))
+				{
+					completeBatchPart(*part, replicated->getResponseCode(), replicated->getResponseData());
+				}
+				else
+				{
+					if (replicated->getOrigin()->finish())
+						replicated->reply(this_status_code);
+					completeKeyRequest(replicated->getOrigin(), message);
+				}
+			}
+		}
+		else if (auto gather = std::dynamic_pointer_cast<ScatterGatherRequest>(request))
+		{
+			if (gather->getResponse(message))
+			{
+				if (gather == rebalance_announcement)
+				{
+					if (!gather->isOk())
+						logger.log("[SERVER] Not all storages accepted the rebalance plan\n",
+								logger::severity::error);
+					// хранилища знают план, можно переносить диапазоны
+					migration->setAnnounced();
+					events->notify();
+				}
+				else
+				{
+					// DELETE_*: записи, прочитанные пока шло удаление, могли попасть в кэш
+					if (read_cache)
+						read_cache->clear();
+					if (in_flight_reads)
+						in_flight_reads->endClear();
+					if (gather->finish())
+						gather->reply(this_status_code);
+				}
+			}
+		}
+		else if (auto part = std::dynamic_pointer_cast<BatchPart>(request))
+		{
+			completeBatchPart(*part, message.getRequestResponseCode(), message.getRawData());
+		}
+		else
+		{
+			// клиенту - с его собственным номером запроса, если TIMEOUT ещё не ушёл
+			if (request->finish())
+				request->sendMessage(SharedObject::Frame(this_status_code, message, request->getCorrelationId()));
+			completeKeyRequest(request, message);
+		}
+	}
+
+	// выполняется только потоком, владеющим хранилищем
+	void processStorage(Storage& storage)
+	{
+		// ответы обрабатываются раньше отправки, чтобы освободившиеся места занять в том же проходе
+		while (!storage.failed && !storage.in_flight.empty() && storage.connection->hasMessage(this_status_code))
+		{
+			try
+			{
+				SharedObject::View message(storage.connection->receiveMessage(), storage.connection->receiveSize());
+				if (message.getRequestResponseCode() == SharedObject::RequestResponseCode::PACKED)
+					FramePack::forEach(message.getRawData(), [&](const char* response, size_t size)
+					{ processStorageResponse(storage, SharedObject::View(response, size)); });
+				else
+					processStorageResponse(storage, message);
+				storage.connection->popMessage();
+			}
+			catch (const std::exception& e)
+			{
+				// поток ответов дальше не разобрать; отправленные запросы снимаются вместе с очередью
+				std::stringstream log;
+				log << "[SERVER] Storage " << storage.connection->getName() << " is out of service: "
+					<< e.what() << std::endl;
+				std::cout << log.str();
+				logger.log(log.str(), logger::severity::error);
+				storage.failed = true;
+			}
+		}
+		if (storage.failed)
+		{
+			dropQueued(storage);
+			storage.scheduled = false;
+			return;
+		}
+
+		storage.takeInbox();
+		auto now = std::chrono::steady_clock::now();
+		// приоритетной полосе хватает места и тогда, когда обычные запросы заняли всю глубину,
+		// но четверть соединения всё равно остаётся под ответы
+		size_t priorityDepth = std::max(storage.depth, std::min(storage.depth + PRIORITY_SLOTS,
+				storage.connection->capacity() * 3 / 4));
+		auto forwardPriority = [&]
+		{
+			for (auto it = storage.priority_to_process.begin();
+				 it != storage.priority_to_process.end() && storage.in_flight.size() < priorityDepth;)
+			{
+				if (storage.waitsForQueued(*it))
+				{
+					++it;
+					continue;
+				}
+				if (!dropExpired(storage, it->request, now))
+					forward(storage, std::move(it->request));
+				it = storage.priority_to_process.erase(it);
+			}
+		};
+		forwardPriority();
+		while (storage.in_flight.size() < storage.depth && storage.hasQueued())
+		{
+			auto request = storage.takeQueued();
+			if (!dropExpired(storage, request, now))
+				forward(storage, std::move(request));
+			// запросы, которых ждал приоритетный, могли только что уйти
+			forwardPriority();
+		}
+		if (!storage.outgoing.empty())
+			sendOutgoing(storage);
+
+		bool hasRoom = storage.in_flight.size() < priorityDepth;
+		storage.scheduled = false;
+		// запрос мог встать в очередь после takeInbox, когда положивший его поток ещё видел хранилище занятым
+		if (hasRoom && storage.hasInbox())
+			scheduleStorage(storage);
 	}
 };
 
@@ -0,0 +1,172 @@
+#ifndef PROGC_SRC_COLLECTIONS_MIGRATION_PLAN_H
+#define PROGC_SRC_COLLECTIONS_MIGRATION_PLAN_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "./consistent_hash_ring.h"
+#include "../extensions/serializable.h"
+
+
+/*
+ План переезда ключей со старого кольца на новое.
+ Точки обоих колец делят кольцо на диапазоны (предыдущая точка, точка], внутри диапазона
+ владельцы (основной и реплики) не меняются ни на старом, ни на новом кольце. Переносятся только диапазоны,
+ у которых сменился набор владельцев; их номера одинаковы у сервера и хранилищ, собравших план из тех же колец.
+ Записи диапазона отдаёт основной старый владелец (источник), остальные старые владельцы свои копии удаляют.
+ Сериализуется как | старое кольцо | varint реплик | новое кольцо | varint реплик |.
+ */
+
+
+class MigrationPlan : public Serializable
+{
+public:
+
+	static inline const size_t NONE = SIZE_MAX;
+
+	struct Range
+	{
+		uint64_t begin; // не входит в диапазон; begin == end - всё кольцо
+		uint64_t end;
+		std::vector<size_t> from; // владельцы на старом кольце, основной первый
+		std::vector<size_t> to; // ... на новом
+
+		size_t source() const
+		{
+			return from.front();
+		}
+
+		// новые владельцы, которым источник отдаёт записи
+		std::vector<size_t> targets() const
+		{
+			std::vector<size_t> result;
+			for (size_t node: to)
+			{
+				if (node != source())
+					result.push_back(node);
+			}
+			return result;
+		}
+
+		// источник остаётся владельцем и оставляет записи себе
+		bool keepsSource() const
+		{
+			return std::find(to.begin(), to.end(), source()) != to.end();
+		}
+	};
+
+private:
+
+	ConsistentHashRing from_ring;
+	size_t from_replicas;
+	ConsistentHashRing to_ring;
+	size_t to_replicas;
+	std::vector<uint64_t> boundaries; // точки обоих колец по возрастанию
+	std::vector<size_t> boundary_range; // номер переносимого диапазона, оканчивающегося на точке, или NONE
+	std::vector<Range> ranges;
+
+	void build()
+	{
+		// с пустого кольца переносить нечего, на пустое - некуда
+		if (from_ring.empty() || to_ring.empty())
+			return;
+		boundaries = from_ring.getPositions();
+		std::vector<uint64_t> toPositions = to_ring.getPositions();
+		boundaries.insert(boundaries.end(), toPositions.begin(), toPositions.end());
+		std::sort(boundaries.begin(), boundaries.end());
+		boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+		boundary_range.assign(boundaries.size(), NONE);
+		for (size_t i = 0; i < boundaries.size(); i++)
+		{
+			uint64_t end = boundaries[i];
+			std::vector<size_t> from = from_ring.ownersOf(end, from_replicas);
+			std::vector<size_t> to = to_ring.ownersOf(end, to_replicas);
+			std::vector<size_t> sortedFrom = from, sortedTo = to;
+			std::sort(sortedFrom.begin(), sortedFrom.end());
+			std::sort(sortedTo.begin(), sortedTo.end());
+			if (sortedFrom == sortedTo)
+				continue;
+			boundary_range[i] = ranges.size();
+			ranges.push_back({ boundaries[i == 0 ? boundaries.size() - 1 : i - 1], end, std::move(from),
+							   std::move(to) });
+		}
+	}
+
+public:
+
+	MigrationPlan(ConsistentHashRing from, size_t fromReplicas, ConsistentHashRing to, size_t toReplicas)
+			: from_ring(std::move(from)), from_replicas(std::max<size_t>(fromReplicas, 1)), to_ring(std::move(to)),
+			  to_replicas(std::max<size_t>(toReplicas, 1))
+	{
+		build();
+	}
+
+	const ConsistentHashRing& getFrom() const
+	{
+		return from_ring;
+	}
+
+	const ConsistentHashRing& getTo() const
+	{
+		return to_ring;
+	}
+
+	size_t getToReplicas() const
+	{
+		return to_replicas;
+	}
+
+	const std::vector<Range>& getRanges() const
+	{
+		return ranges;
+	}
+
+	// номер переносимого диапазона с ключом или NONE, если владелец ключа не меняется
+	size_t rangeFor(uint64_t keyHash) const
+	{
+		if (boundaries.empty())
+			return NONE;
+		uint64_t position = ConsistentHashRing::positionOf(keyHash);
+		auto boundary = std::lower_bound(boundaries.begin(), boundaries.end(), position);
+		if (boundary == boundaries.end())
+			boundary = boundaries.begin();
+		return boundary_range[boundary - boundaries.begin()];
+	}
+
+	size_t serializedSize() const override
+	{
+		return from_ring.serializedSize() + WireFormat::varintSize(from_replicas) + to_ring.serializedSize()
+			   + WireFormat::varintSize(to_replicas);
+	}
+
+	void serializeTo(char* buffer) const override
+	{
+		from_ring.serializeTo(buffer);
+		buffer = WireFormat::writeVarint(buffer + from_ring.serializedSize(), from_replicas);
+		to_ring.serializeTo(buffer);
+		WireFormat::writeVarint(buffer + to_ring.serializedSize(), to_replicas);
+	}
+
+	std::string serialize() const override
+	{
+		std::string result(serializedSize(), '\0');
+		serializeTo(&result[0]);
+		return result;
+	}
+
+	static MigrationPlan deserialize(std::string_view serializedPlan)
+	{
+		const char* ptr = serializedPlan.data();
+		ConsistentHashRing from = ConsistentHashRing::read(ptr);
+		size_t fromReplicas = WireFormat::readVarint(ptr);
+		ConsistentHashRing to = ConsistentHashRing::read(ptr);
+		size_t toReplicas = WireFormat::readVarint(ptr);
+		return { std::move(from), fromReplicas, std::move(to), toReplicas };
+	}
+};
+
+
+#endif //PROGC_SRC_COLLECTIONS_MIGRATION_PLAN_H
@@ -0,0 +1,147 @@
+#ifndef PROGC_SRC_CONCURRENCY_WAIT_STRATEGY_H
+#define PROGC_SRC_CONCURRENCY_WAIT_STRATEGY_H
+
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "./shared_event.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+/*
+ Ожидание в три фазы:
+ 1. spin_count раз проверяет условие, между проверками - инструкция pause;
+ 2. yield_count раз проверяет условие, отдавая квант другим потокам;
+ 3. паркуется на SharedEvent (спит в ядре, пока не позвонят).
+ Чем больше бюджеты, тем меньше задержка и тем больше тратится процессора, поэтому они задаются
+ для каждого процессора отдельно. Счётчики показывают, на какой фазе заканчивались ожидания.
+ */
+
+
+class WaitStrategy
+{
+public:
+
+	static inline const size_t DEFAULT_SPIN_COUNT = 1000;
+	static inline const size_t DEFAULT_YIELD_COUNT = 50;
+	static inline const std::chrono::seconds REPORT_PERIOD = std::chrono::seconds(60);
+
+	struct Statistics
+	{
+		size_t waits = 0;
+		size_t spin_hits = 0; // условие выполнилось во время spin
+		size_t yield_hits = 0; // ... во время yield
+		size_t parks = 0; // пришлось парковаться
+		size_t park_timeouts = 0; // парковка закончилась таймаутом
+	};
+
+private:
+
+	size_t spin_count;
+	size_t yield_count;
+	Statistics statistics;
+	std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+
+	static void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	// фазы spin и yield; true - условие выполнилось и парковаться не нужно
+	template<typename Predicate>
+	bool spin(Predicate& ready)
+	{
+		statistics.waits++;
+		for (size_t i = 0; i < spin_count; i++)
+		{
+			if (ready())
+			{
+				statistics.spin_hits++;
+				return true;
+			}
+			cpuRelax();
+		}
+		for (size_t i = 0; i < yield_count; i++)
+		{
+			if (ready())
+			{
+				statistics.yield_hits++;
+				return true;
+			}
+			std::this_thread::yield();
+		}
+		statistics.parks++;
+		return false;
+	}
+
+public:
+
+	explicit WaitStrategy(size_t spinCount = DEFAULT_SPIN_COUNT, size_t yieldCount = DEFAULT_YIELD_COUNT)
+			: spin_count(spinCount), yield_count(yieldCount)
+	{
+	}
+
+	// ждёт, пока счётчик event отличается от seen (или до таймаута)
+	void wait(const SharedEvent& event, uint32_t seen,
+			std::chrono::milliseconds timeout = SharedEvent::IDLE_TIMEOUT)
+	{
+		auto changed = [&]
+		{ return event.sequence() != seen; };
+		if (spin(changed))
+			return;
+		if (!event.wait(seen, timeout))
+			statistics.park_timeouts++;
+	}
+
+	// ждёт, пока ready() не вернёт true
+	template<typename Predicate>
+	void waitFor(const SharedEvent& event, Predicate ready)
+	{
+		if (spin(ready))
+			return;
+		while (true)
+		{
+			uint32_t seen = event.sequence();
+			if (ready())
+				return;
+			if (!event.wait(seen))
+				statistics.park_timeouts++;
+		}
+	}
+
+	const Statistics& getStatistics() const
+	{
+		return statistics;
+	}
+
+	// раз в REPORT_PERIOD возвращает true - пора записать счётчики в лог
+	bool reportDue()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_report < REPORT_PERIOD)
+			return false;
+		last_report = now;
+		return true;
+	}
+
+	std::string getPrint() const
+	{
+		std::stringstream ss;
+		ss << "waits: " << statistics.waits << ", spin: " << statistics.spin_hits << ", yield: "
+		   << statistics.yield_hits << ", park: " << statistics.parks << " (timeouts: " << statistics.park_timeouts
+		   << "), budgets: " << spin_count << "/" << yield_count;
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_CONCURRENCY_WAIT_STRATEGY_H
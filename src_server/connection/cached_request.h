@@ -0,0 +1,114 @@
+#ifndef PROGC_SRC_CONNECTION_CACHED_REQUEST_H
+#define PROGC_SRC_CONNECTION_CACHED_REQUEST_H
+
+
+#include <mutex>
+#include <vector>
+#include "./pending_request.h"
+#include "../data_types/request_object.h"
+#include "../data_types/contest_info.h"
+
+
+// запрос к записи, который касается кэша чтений: ответ на чтение кладётся в кэш, запись удаляет ключ
+// к чтению, пока оно у хранилища, могут присоединиться такие же чтения других клиентов - ответ получат все
+class CachedRequest : public PendingRequest
+{
+private:
+
+	const std::string cache_key;
+	const RequestObject<ContestInfo>::RequestCode request_code;
+	const uint64_t cache_epoch; // эпоха шарда при промахе, для записей не нужна
+
+	struct Follower
+	{
+		std::shared_ptr<Connection> connection;
+		uint64_t correlation_id;
+	};
+
+	std::mutex followers_mutex; // присоединяются потоки клиентов, отвечает поток хранилища
+	std::vector<Follower> followers;
+	bool answered = false;
+
+public:
+
+	CachedRequest(std::shared_ptr<Connection> connection, std::string cacheKey,
+			RequestObject<ContestInfo>::RequestCode requestCode, uint64_t cacheEpoch = 0)
+			: PendingRequest(std::move(connection)), cache_key(std::move(cacheKey)), request_code(requestCode),
+			  cache_epoch(cacheEpoch)
+	{
+	}
+
+	const std::string& getCacheKey() const
+	{
+		return cache_key;
+	}
+
+	RequestObject<ContestInfo>::RequestCode getRequestCode() const
+	{
+		return request_code;
+	}
+
+	uint64_t getCacheEpoch() const
+	{
+		return cache_epoch;
+	}
+
+	// false - ответ уже разослан, присоединяться поздно
+	bool addFollower(std::shared_ptr<Connection> connection, uint64_t correlationId)
+	{
+		std::lock_guard<std::mutex> lock(followers_mutex);
+		if (answered)
+			return false;
+		followers.push_back({ std::move(connection), correlationId });
+		return true;
+	}
+
+	bool isAnswered()
+	{
+		std::lock_guard<std::mutex> lock(followers_mutex);
+		return answered;
+	}
+
+	// ответ хранилища - каждому присоединившемуся с его номером запроса
+	void replyFollowers(int statusCode, const SharedObject::View& response)
+	{
+		std::lock_guard<std::mutex> lock(followers_mutex);
+		answered = true;
+		for (const auto& follower: followers)
+		{
+			follower.connection->sendMessage(SharedObject::Frame(statusCode, response, follower.correlation_id));
+		}
+		followers.clear();
+	}
+
+	// ответ первого чтения годится только ему самому (ERROR: хранилище не приняло его ключ маршрутизации,
+	// а он у присоединившихся мог быть верным), поэтому они повторяют свои запросы
+	void retryFollowers(int statusCode)
+	{
+		std::lock_guard<std::mutex> lock(followers_mutex);
+		answered = true;
+		for (const auto& follower: followers)
+		{
+			follower.connection->sendMessage(SharedObject::Frame(statusCode,
+					SharedObject::RequestResponseCode::RETRY_LATER, SharedObject::NULL_DATA, follower.correlation_id));
+		}
+		followers.clear();
+	}
+
+	// срок истёк у первого чтения - присоединившиеся получают TIMEOUT вместе с ним и больше не присоединяются
+	void replyTimeout(int statusCode) override
+	{
+		PendingRequest::replyTimeout(statusCode);
+		std::lock_guard<std::mutex> lock(followers_mutex);
+		answered = true;
+		for (const auto& follower: followers)
+		{
+			follower.connection->sendMessage(SharedObject::Frame(statusCode, SharedObject::RequestResponseCode::TIMEOUT,
+					SharedObject::NULL_DATA, follower.correlation_id));
+		}
+		followers.clear();
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_CACHED_REQUEST_H
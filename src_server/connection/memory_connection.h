@@ -5,6 +5,7 @@
 #include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 #include "./connection.h"
+#include "./connection_events.h"
 #include "../extensions/serializable.h"
 
 
@@ -13,14 +14,27 @@ using namespace boost::interprocess;
 
 class MemoryConnection : public Connection
 {
+public:
+
+	static inline const size_t DEFAULT_MESSAGE_SIZE = 1024;
+
 private:
 
 	mapped_region* mreg;
 	const bool is_server;
+	ConnectionEvents events;
+
+	// сегмент: | EventNames | кадр |
+	char* frame() const
+	{
+		return static_cast<char*>(mreg->get_address()) + sizeof(EventNames);
+	}
 
 public:
 
-	MemoryConnection(bool isServer, const std::string& memoryName) : is_server(isServer)
+	// messageSize выбирает создающая сторона, открывающая узнаёт его по размеру сегмента
+	MemoryConnection(bool isServer, const std::string& memoryName, size_t messageSize = DEFAULT_MESSAGE_SIZE)
+			: is_server(isServer)
 	{
 		Connection::connectionName = memoryName;
 		if (is_server)
@@ -30,13 +44,15 @@ public:
 			catch (...)
 			{}
 			shared_memory_object shm(create_only, Connection::connectionName.c_str(), read_write);
-			shm.truncate(1024);
+			shm.truncate(static_cast<offset_t>(sizeof(EventNames) + messageSize));
 			mreg = new mapped_region(shm, read_write);
+			events.attach(static_cast<EventNames*>(mreg->get_address()), is_server, true);
 		}
 		else
 		{
 			shared_memory_object shm(open_only, Connection::connectionName.c_str(), read_write);
 			mreg = new mapped_region(shm, read_write);
+			events.attach(static_cast<EventNames*>(mreg->get_address()), is_server, false);
 		}
 	}
 
@@ -49,19 +65,37 @@ public:
 		delete mreg;
 	}
 
+	size_t getMessageSize() const
+	{
+		return mreg->get_size() - sizeof(EventNames);
+	}
+
 	const char* receiveMessage() const override
 	{
-		return static_cast<const char*>(mreg->get_address());
+		return frame();
+	}
+
+	size_t receiveSize() const override
+	{
+		return getMessageSize();
+	}
+
+	void setReceiveEvent(const SharedEvent& event) const override
+	{
+		events.subscribe(event);
 	}
 
 	// первый байт (статус) изменяется после записи данных
 	void sendMessage(const Serializable& data) const override
 	{
 		std::string str = data.serialize();
+		if (str.length() > getMessageSize())
+			throw std::runtime_error("Message does not fit into the connection segment");
 		const char* data_str = str.c_str();
-		char* address = static_cast<char*>(mreg->get_address());
+		char* address = frame();
 		memcpy(address + 1, data_str + 1, str.length() - 1);
 		*address = *data_str;
+		events.notifyPeer();
 	}
 };
 
@@ -0,0 +1,205 @@
+#ifndef PROGC_SRC_CONNECTION_RESPONSE_REDUCER_H
+#define PROGC_SRC_CONNECTION_RESPONSE_REDUCER_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../data_types/shared_object.h"
+#include "../data_types/wire_format.h"
+
+
+// сводит ответы хранилищ на разосланный всем запрос в один ответ; вызовы приходят по одному
+class ResponseReducer
+{
+public:
+
+	virtual ~ResponseReducer() = default;
+
+	virtual void add(const SharedObject::View& response) = 0;
+
+	virtual SharedObject::RequestResponseCode getCode() const = 0;
+
+	virtual std::string getData() const = 0;
+};
+
+
+// OK "true", если хоть одно хранилище ответило OK: DELETE_* удаляют то, что есть не на всех хранилищах
+class AnyOkReducer : public ResponseReducer
+{
+private:
+
+	bool ok = false;
+
+public:
+
+	void add(const SharedObject::View& response) override
+	{
+		ok = ok || response.getRequestResponseCode() == SharedObject::RequestResponseCode::OK;
+	}
+
+	SharedObject::RequestResponseCode getCode() const override
+	{
+		return SharedObject::RequestResponseCode::OK;
+	}
+
+	std::string getData() const override
+	{
+		return ok ? "true" : "false";
+	}
+};
+
+
+// OK, только если OK ответили все
+class AllOkReducer : public ResponseReducer
+{
+private:
+
+	bool ok = true;
+
+public:
+
+	void add(const SharedObject::View& response) override
+	{
+		ok = ok && response.getRequestResponseCode() == SharedObject::RequestResponseCode::OK;
+	}
+
+	SharedObject::RequestResponseCode getCode() const override
+	{
+		return ok ? SharedObject::RequestResponseCode::OK : SharedObject::RequestResponseCode::ERROR;
+	}
+
+	std::string getData() const override
+	{
+		return SharedObject::NULL_DATA;
+	}
+};
+
+
+// данные ответов - целые числа (например, сколько записей у хранилища), результат - их сумма
+class SumReducer : public ResponseReducer
+{
+private:
+
+	long long sum = 0;
+	bool ok = true;
+
+public:
+
+	void add(const SharedObject::View& response) override
+	{
+		auto data = response.getData();
+		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK || !data)
+		{
+			ok = false;
+			return;
+		}
+		sum += std::stoll(std::string(data.value()));
+	}
+
+	SharedObject::RequestResponseCode getCode() const override
+	{
+		return ok ? SharedObject::RequestResponseCode::OK : SharedObject::RequestResponseCode::ERROR;
+	}
+
+	std::string getData() const override
+	{
+		return std::to_string(sum);
+	}
+};
+
+
+/*
+ Данные ответов - отсортированные списки | varint число элементов | varint длина | элемент | ... |,
+ результат - их слияние в том же формате, не длиннее limit.
+ Каждое хранилище сортирует только своё, слияние k списков кучей - O(n log k).
+ */
+class SortedMergeReducer : public ResponseReducer
+{
+public:
+
+	using Less = std::function<bool(std::string_view, std::string_view)>;
+
+private:
+
+	const Less less;
+	const size_t limit;
+	std::vector<std::vector<std::string>> lists;
+	bool ok = true;
+
+public:
+
+	explicit SortedMergeReducer(Less less = std::less<std::string_view>(), size_t limit = SIZE_MAX)
+			: less(std::move(less)), limit(limit)
+	{
+	}
+
+	void add(const SharedObject::View& response) override
+	{
+		if (response.getRequestResponseCode() != SharedObject::RequestResponseCode::OK)
+		{
+			ok = false;
+			return;
+		}
+		std::string_view data = response.getRawData();
+		const char* ptr = data.data();
+		size_t count = WireFormat::readVarint(ptr);
+		std::vector<std::string> list;
+		list.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t length = WireFormat::readVarint(ptr);
+			list.emplace_back(ptr, length);
+			ptr += length;
+		}
+		lists.push_back(std::move(list));
+	}
+
+	SharedObject::RequestResponseCode getCode() const override
+	{
+		return ok ? SharedObject::RequestResponseCode::OK : SharedObject::RequestResponseCode::ERROR;
+	}
+
+	std::string getData() const override
+	{
+		// (список, позиция); наверху кучи - наименьший текущий элемент
+		using Cursor = std::pair<size_t, size_t>;
+		auto greater = [this](const Cursor& a, const Cursor& b)
+		{ return less(lists[b.first][b.second], lists[a.first][a.second]); };
+		std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(greater);
+		for (size_t i = 0; i < lists.size(); i++)
+		{
+			if (!lists[i].empty())
+				heap.emplace(i, 0);
+		}
+
+		std::vector<const std::string*> merged;
+		while (!heap.empty() && merged.size() < limit)
+		{
+			auto [list, position] = heap.top();
+			heap.pop();
+			merged.push_back(&lists[list][position]);
+			if (position + 1 < lists[list].size())
+				heap.emplace(list, position + 1);
+		}
+
+		size_t size = WireFormat::varintSize(merged.size());
+		for (auto item: merged)
+			size += WireFormat::varintSize(item->size()) + item->size();
+		std::string result(size, '\0');
+		char* ptr = WireFormat::writeVarint(&result[0], merged.size());
+		for (auto item: merged)
+		{
+			ptr = WireFormat::writeVarint(ptr, item->size());
+			ptr = std::copy(item->begin(), item->end(), ptr);
+		}
+		return result;
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_RESPONSE_REDUCER_H
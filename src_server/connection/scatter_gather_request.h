@@ -0,0 +1,68 @@
+#ifndef PROGC_SRC_CONNECTION_SCATTER_GATHER_REQUEST_H
+#define PROGC_SRC_CONNECTION_SCATTER_GATHER_REQUEST_H
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "./pending_request.h"
+#include "./response_reducer.h"
+
+
+// запрос, разосланный во все хранилища; ответы сводит reducer, клиенту отвечают после ответа последнего
+// ответы хранилищ приходят из разных потоков
+class ScatterGatherRequest : public PendingRequest
+{
+private:
+
+	std::atomic<int> waitResponseCount;
+	std::mutex reducer_mutex;
+	const std::unique_ptr<ResponseReducer> reducer;
+
+public:
+
+	// текущий кадр соединения клиента
+	ScatterGatherRequest(std::shared_ptr<Connection> connection, int waitResponseCount,
+			std::unique_ptr<ResponseReducer> reducer)
+			: PendingRequest(std::move(connection)), waitResponseCount(waitResponseCount), reducer(std::move(reducer))
+	{
+		if (waitResponseCount < 1)
+			throw std::runtime_error("Response count must be > 0");
+	}
+
+	// кадр от имени сервера; connection может быть nullptr
+	ScatterGatherRequest(std::shared_ptr<Connection> connection, std::string message, int waitResponseCount,
+			std::unique_ptr<ResponseReducer> reducer)
+			: PendingRequest(std::move(connection), std::move(message)), waitResponseCount(waitResponseCount),
+			  reducer(std::move(reducer))
+	{
+		if (waitResponseCount < 1)
+			throw std::runtime_error("Response count must be > 0");
+	}
+
+	// returns is the required number of responses received
+	bool getResponse(const SharedObject::View& response)
+	{
+		{
+			std::lock_guard<std::mutex> lock(reducer_mutex);
+			reducer->add(response);
+		}
+		return --waitResponseCount < 1;
+	}
+
+	bool isOk()
+	{
+		std::lock_guard<std::mutex> lock(reducer_mutex);
+		return reducer->getCode() == SharedObject::RequestResponseCode::OK;
+	}
+
+	// клиенту - с его собственным номером запроса
+	void reply(int statusCode)
+	{
+		std::lock_guard<std::mutex> lock(reducer_mutex);
+		sendMessage(SharedObject::Frame(statusCode, reducer->getCode(), reducer->getData(), getCorrelationId()));
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_SCATTER_GATHER_REQUEST_H
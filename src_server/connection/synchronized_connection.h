@@ -0,0 +1,62 @@
+#ifndef PROGC_SRC_CONNECTION_SYNCHRONIZED_CONNECTION_H
+#define PROGC_SRC_CONNECTION_SYNCHRONIZED_CONNECTION_H
+
+
+#include <memory>
+#include <mutex>
+#include "./connection.h"
+
+
+// соединение, в которое могут отвечать несколько потоков сразу; читает из него по-прежнему один поток
+class SynchronizedConnection : public Connection
+{
+private:
+
+	const std::shared_ptr<Connection> connection;
+	mutable std::mutex send_mutex;
+
+public:
+
+	explicit SynchronizedConnection(std::shared_ptr<Connection> connection) : connection(std::move(connection))
+	{
+		Connection::connectionName = this->connection->getName();
+	}
+
+	const char* receiveMessage() const override
+	{
+		return connection->receiveMessage();
+	}
+
+	size_t receiveSize() const override
+	{
+		return connection->receiveSize();
+	}
+
+	void sendMessage(const Serializable& data) const override
+	{
+		std::lock_guard<std::mutex> lock(send_mutex);
+		connection->sendMessage(data);
+	}
+
+	bool hasMessage(int statusCode) const override
+	{
+		return connection->hasMessage(statusCode);
+	}
+
+	void popMessage() const override
+	{
+		connection->popMessage();
+	}
+
+	size_t capacity() const override
+	{
+		return connection->capacity();
+	}
+
+	SynchronizedConnection(const SynchronizedConnection&) = delete;
+
+	SynchronizedConnection& operator=(const SynchronizedConnection&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONNECTION_SYNCHRONIZED_CONNECTION_H
@@ -3,21 +3,32 @@
 
 
 const std::string CON_MEM_NAME = "con_mem";
-const std::string CON_MUTEX_NAME = "con_mutex";
 const int SERVER_STATUS_CODE = 1;
 const int LOG_SERVER_STATUS_CODE = 4;
 const std::string LOG_MEM_NAME = "log_mem";
-const std::string LOG_MUTEX_NAME = "log_mutex";
+const std::string LISTEN_ADDRESS = "unix:/tmp/progc_server.sock";
+// сервер на пути каждого запроса, поэтому крутится дольше остальных
+const size_t SPIN_COUNT = 4000;
+const size_t YIELD_COUNT = 100;
+// половина ядер: остальные нужны хранилищам и клиентам на той же машине
+const size_t WORKER_COUNT = std::max(2u, std::thread::hardware_concurrency() / 2);
+const size_t STORAGE_DEPTH = 16; // запросов в работе у каждого хранилища
+const size_t REPLICATION_FACTOR = 1; // сколько хранилищ держат каждый ключ
 
 
-int main()
+// argv[1] - адрес для подключений через сокеты (unix:/путь или tcp:хост:порт)
+// argv[2] - сколько хранилищ держат каждый ключ
+int main(int argc, char* argv[])
 {
-	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME, LOG_MUTEX_NAME);
-	ServerProcessor serverProcessor(SERVER_STATUS_CODE, CON_MEM_NAME, CON_MUTEX_NAME, serverLogger);
+	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME);
+	ServerProcessor serverProcessor(SERVER_STATUS_CODE, CON_MEM_NAME, serverLogger,
+			argc > 1 ? argv[1] : LISTEN_ADDRESS, WaitStrategy(SPIN_COUNT, YIELD_COUNT), WORKER_COUNT,
+			STORAGE_DEPTH);
+	serverProcessor.setReplicationFactor(argc > 2 ? std::stoul(argv[2]) : REPLICATION_FACTOR);
 	while (true)
 	{
 		serverProcessor.process();
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		serverProcessor.waitMessages();
 	}
 
 	return 0;
@@ -0,0 +1,247 @@
+#ifndef PROGC_SRC_PROCESSORS_SERVER_LOAD_TRACKER_H
+#define PROGC_SRC_PROCESSORS_SERVER_LOAD_TRACKER_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+
+/*
+ Нагрузка на хранилища и ключи: запросы в секунду, затухающие с полупериодом HALF_LIFE.
+ Счётчики прямого затухания: запрос в момент t добавляет 2^((t - landmark) / HALF_LIFE), так что
+ счётчики не надо пересчитывать при каждом запросе и их можно сравнивать между собой. landmark
+ сдвигается на каждой проверке, чтобы веса не росли без конца.
+ Для ключей помнятся только самые нагруженные (space-saving): новый ключ вытесняет наименее
+ нагруженный и наследует его счёт, поэтому горячий ключ не теряется.
+ Считают потоки пула; checkHot, reset и сдвиг landmark - главный поток между проходами.
+ */
+
+
+class LoadTracker
+{
+public:
+
+	struct Settings
+	{
+		bool split_hot_ranges = true;
+		double hot_factor = 1.5; // нагрузка хранилища выше средней во столько раз - перегрузка
+		double min_rate = 200; // запросов в секунду, меньшая нагрузка перегрузкой не считается
+		size_t sustained_checks = 3; // перегрузка должна продержаться столько проверок подряд
+		std::chrono::milliseconds check_interval{ 1000 };
+		size_t max_splits = 256; // точек разбиения на кольце
+	};
+
+	struct Key
+	{
+		uint64_t key_hash;
+		double rate;
+	};
+
+	struct Statistics
+	{
+		std::vector<double> storage_rates; // по номеру хранилища
+		std::vector<Key> hot_keys; // по убыванию нагрузки
+	};
+
+	static inline const std::chrono::milliseconds HALF_LIFE{ 2000 };
+	static inline const size_t KEY_SHARD_COUNT = 16;
+	static inline const size_t KEYS_PER_SHARD = 32;
+
+private:
+
+	using Clock = std::chrono::steady_clock;
+
+	struct StorageLoad
+	{
+		std::mutex mutex;
+		double score = 0;
+		size_t hot_checks = 0; // проверок подряд с перегрузкой; только главный поток
+	};
+
+	struct KeyShard
+	{
+		std::mutex mutex;
+		std::unordered_map<uint64_t, double> scores;
+	};
+
+	std::deque<StorageLoad> storages; // deque - мьютексы не перемещаются
+	std::vector<KeyShard> key_shards;
+	Clock::time_point landmark = Clock::now();
+	Clock::time_point last_check = Clock::now();
+
+	double weight(Clock::time_point now) const
+	{
+		return std::exp2(std::chrono::duration<double>(now - landmark).count()
+						 / std::chrono::duration<double>(HALF_LIFE).count());
+	}
+
+	// счёт в запросы в секунду на момент now
+	double toRate(double score, Clock::time_point now) const
+	{
+		return score / weight(now) * std::log(2.0) / std::chrono::duration<double>(HALF_LIFE).count();
+	}
+
+	void moveLandmark(Clock::time_point now)
+	{
+		double scale = 1 / weight(now);
+		for (auto& storage: storages)
+		{
+			std::lock_guard<std::mutex> lock(storage.mutex);
+			storage.score *= scale;
+		}
+		for (auto& shard: key_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			for (auto& key: shard.scores)
+				key.second *= scale;
+		}
+		landmark = now;
+	}
+
+public:
+
+	LoadTracker() : key_shards(KEY_SHARD_COUNT)
+	{
+	}
+
+	// между проходами, когда подключаются хранилища
+	void resize(size_t storageCount)
+	{
+		while (storages.size() < storageCount)
+			storages.emplace_back();
+	}
+
+	void recordStorage(size_t storage)
+	{
+		double added = weight(Clock::now());
+		std::lock_guard<std::mutex> lock(storages.at(storage).mutex);
+		storages.at(storage).score += added;
+	}
+
+	void recordKey(uint64_t keyHash)
+	{
+		double added = weight(Clock::now());
+		KeyShard& shard = key_shards[keyHash % key_shards.size()];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto key = shard.scores.find(keyHash);
+		if (key != shard.scores.end())
+		{
+			key->second += added;
+			return;
+		}
+		if (shard.scores.size() < KEYS_PER_SHARD)
+		{
+			shard.scores.emplace(keyHash, added);
+			return;
+		}
+		auto coldest = std::min_element(shard.scores.begin(), shard.scores.end(),
+				[](const auto& a, const auto& b)
+				{ return a.second < b.second; });
+		double inherited = coldest->second;
+		shard.scores.erase(coldest);
+		shard.scores.emplace(keyHash, inherited + added);
+	}
+
+	std::vector<double> getStorageRates()
+	{
+		auto now = Clock::now();
+		std::vector<double> rates;
+		for (auto& storage: storages)
+		{
+			std::lock_guard<std::mutex> lock(storage.mutex);
+			rates.push_back(toRate(storage.score, now));
+		}
+		return rates;
+	}
+
+	// все запомненные ключи
+	std::vector<Key> getKeys()
+	{
+		auto now = Clock::now();
+		std::vector<Key> keys;
+		for (auto& shard: key_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			for (const auto& key: shard.scores)
+				keys.push_back({ key.first, toRate(key.second, now) });
+		}
+		return keys;
+	}
+
+	Statistics getStatistics(size_t hotKeyCount = 8)
+	{
+		Statistics statistics{ getStorageRates(), getKeys() };
+		std::sort(statistics.hot_keys.begin(), statistics.hot_keys.end(), [](const Key& a, const Key& b)
+		{ return a.rate > b.rate; });
+		if (statistics.hot_keys.size() > hotKeyCount)
+			statistics.hot_keys.resize(hotKeyCount);
+		return statistics;
+	}
+
+	// раз в check_interval; хранилище, перегруженное sustained_checks проверок подряд, самое нагруженное из таких
+	std::optional<size_t> checkHot(const Settings& settings)
+	{
+		auto now = Clock::now();
+		if (now - last_check < settings.check_interval)
+			return std::nullopt;
+		last_check = now;
+		moveLandmark(now);
+
+		std::vector<double> rates = getStorageRates();
+		if (rates.size() < 2)
+			return std::nullopt;
+		double mean = 0;
+		for (double rate: rates)
+			mean += rate / static_cast<double>(rates.size());
+		std::optional<size_t> hottest;
+		for (size_t storage = 0; storage < rates.size(); storage++)
+		{
+			bool hot = rates[storage] >= settings.min_rate && rates[storage] > mean * settings.hot_factor;
+			size_t& checks = storages[storage].hot_checks;
+			checks = hot ? checks + 1 : 0;
+			if (checks >= settings.sustained_checks && (!hottest || rates[storage] > rates[hottest.value()]))
+				hottest = storage;
+		}
+		return hottest;
+	}
+
+	// после смены размещения старые счета его не описывают
+	void reset()
+	{
+		for (auto& storage: storages)
+		{
+			std::lock_guard<std::mutex> lock(storage.mutex);
+			storage.score = 0;
+			storage.hot_checks = 0;
+		}
+		for (auto& shard: key_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.scores.clear();
+		}
+	}
+
+	std::string getPrint()
+	{
+		Statistics statistics = getStatistics(4);
+		std::stringstream ss;
+		ss.precision(1);
+		ss << std::fixed << "requests/s by storage";
+		for (double rate: statistics.storage_rates)
+			ss << " " << rate;
+		ss << ", hottest keys (candidate/contest)";
+		for (const auto& key: statistics.hot_keys)
+			ss << " " << (key.key_hash >> 32) << "/" << (key.key_hash & 0xFFFFFFFFu) << ": " << key.rate;
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_PROCESSORS_SERVER_LOAD_TRACKER_H
@@ -0,0 +1,123 @@
+#ifndef PROGC_SRC_PROCESSORS_SERVER_TIMER_WHEEL_H
+#define PROGC_SRC_PROCESSORS_SERVER_TIMER_WHEEL_H
+
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../../connection/pending_request.h"
+
+
+/*
+ Сроки запросов клиентов. Время делится на тики, слот колеса - тик по модулю числа слотов:
+ постановка - добавление в слот, проход за тик - разбор одного слота, так что тысячи ждущих запросов
+ не стоят ничего, пока их срок не наступил. Срок дальше оборота колеса лежит в своём слоте, пока до него
+ не дойдёт очередь. Колесо не держит запросы: отвеченный раньше срока просто не найдётся.
+ */
+
+
+class TimerWheel
+{
+public:
+
+	using Clock = std::chrono::steady_clock;
+
+	static inline const std::chrono::milliseconds DEFAULT_TICK{ 10 };
+	static inline const size_t DEFAULT_SLOT_COUNT = 1024;
+
+private:
+
+	struct Entry
+	{
+		uint64_t tick; // номер тика, на котором срок наступает
+		std::weak_ptr<PendingRequest> request;
+	};
+
+	const std::chrono::milliseconds tick_length;
+	const Clock::time_point start = Clock::now();
+	std::mutex mutex; // ставят потоки клиентов, разбирает главный поток
+	std::vector<std::vector<Entry>> slots;
+	uint64_t current_tick = 0; // тики до него разобраны
+	size_t size = 0;
+
+	uint64_t tickOf(Clock::time_point time) const
+	{
+		if (time <= start)
+			return 0;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(time - start) / tick_length;
+	}
+
+public:
+
+	explicit TimerWheel(std::chrono::milliseconds tick = DEFAULT_TICK, size_t slotCount = DEFAULT_SLOT_COUNT)
+			: tick_length(std::max(tick, std::chrono::milliseconds(1))), slots(std::max<size_t>(slotCount, 1))
+	{
+	}
+
+	std::chrono::milliseconds getTick() const
+	{
+		return tick_length;
+	}
+
+	// запрос без срока не ставится
+	void add(const std::shared_ptr<PendingRequest>& request)
+	{
+		if (request->getDeadline() == Clock::time_point::max())
+			return;
+		// срок, наступивший внутри тика, разбирается в конце этого тика
+		uint64_t tick = tickOf(request->getDeadline()) + 1;
+		std::lock_guard<std::mutex> lock(mutex);
+		tick = std::max(tick, current_tick);
+		slots[tick % slots.size()].push_back({ tick, request });
+		size++;
+	}
+
+	bool empty()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return size == 0;
+	}
+
+	// запросы, срок которых наступил к now и которые ещё живы
+	std::vector<std::shared_ptr<PendingRequest>> advance(Clock::time_point now = Clock::now())
+	{
+		std::vector<std::shared_ptr<PendingRequest>> result;
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t last = tickOf(now);
+		// за одно обращение - не больше оборота: дальше те же слоты
+		if (last >= current_tick + slots.size())
+			current_tick = last + 1 - slots.size();
+		for (; current_tick <= last; current_tick++)
+		{
+			auto& slot = slots[current_tick % slots.size()];
+			for (size_t i = 0; i < slot.size();)
+			{
+				if (slot[i].tick > last)
+				{
+					i++;
+					continue;
+				}
+				if (auto request = slot[i].request.lock())
+					result.push_back(std::move(request));
+				slot[i] = std::move(slot.back());
+				slot.pop_back();
+				size--;
+			}
+		}
+		return result;
+	}
+
+	std::string getPrint()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::stringstream ss;
+		ss << "pending " << size << ", tick " << tick_length.count() << " ms";
+		return ss.str();
+	}
+};
+
+
+#endif //PROGC_SRC_PROCESSORS_SERVER_TIMER_WHEEL_H
@@ -0,0 +1,182 @@
+#ifndef PROGC_SRC_CONCURRENCY_WORK_STEALING_POOL_H
+#define PROGC_SRC_CONCURRENCY_WORK_STEALING_POOL_H
+
+
+#include <atomic>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+
+/*
+ Пул потоков с очередью задач у каждого потока.
+ Задача, порождённая внутри пула, кладётся в конец очереди своего потока и оттуда же берётся (LIFO -
+ данные ещё в кэше), а простаивающий поток крадёт задачи из начала чужих очередей.
+ Задачи извне раскладываются по очередям по кругу.
+ Потоки без работы спят на condition_variable, так что пустой пул не тратит процессор.
+ */
+
+
+class WorkStealingPool
+{
+public:
+
+	using Task = std::function<void()>;
+
+private:
+
+	struct alignas(64) Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next_worker{ 0 }; // куда положить следующую задачу извне
+	std::atomic<size_t> queued{ 0 }; // лежат в очередях
+	std::atomic<size_t> pending{ 0 }; // ещё не выполнены
+	std::mutex idle_mutex;
+	std::condition_variable work_available;
+	std::condition_variable all_done;
+	bool stopping = false;
+	std::exception_ptr failure; // первое исключение из задач, бросается из waitIdle
+
+	static inline thread_local const WorkStealingPool* current_pool = nullptr;
+	static inline thread_local size_t current_worker = 0;
+
+	bool tryTake(size_t index, Task& task)
+	{
+		{
+			Worker& own = *workers[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty())
+			{
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < workers.size(); i++)
+		{
+			Worker& victim = *workers[(index + i) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty())
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void run(size_t index)
+	{
+		current_pool = this;
+		current_worker = index;
+		while (true)
+		{
+			Task task;
+			if (!tryTake(index, task))
+			{
+				std::unique_lock<std::mutex> lock(idle_mutex);
+				work_available.wait(lock, [this]
+				{ return stopping || queued.load() > 0; });
+				if (stopping && queued.load() == 0)
+					return;
+				continue;
+			}
+			queued--;
+			try
+			{ task(); }
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex);
+				if (!failure)
+					failure = std::current_exception();
+			}
+			if (--pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(idle_mutex);
+				all_done.notify_all();
+			}
+		}
+	}
+
+public:
+
+	explicit WorkStealingPool(size_t threadCount)
+	{
+		threadCount = std::max<size_t>(threadCount, 1);
+		for (size_t i = 0; i < threadCount; i++)
+		{
+			workers.push_back(std::make_unique<Worker>());
+		}
+		for (size_t i = 0; i < threadCount; i++)
+		{
+			threads.emplace_back(&WorkStealingPool::run, this, i);
+		}
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+		for (auto& thread: threads)
+		{
+			thread.join();
+		}
+	}
+
+	size_t size() const
+	{
+		return workers.size();
+	}
+
+	void submit(Task task)
+	{
+		pending++;
+		{
+			// счётчик растёт раньше, чем задача появится в очереди, чтобы взявший её поток не увёл его ниже нуля
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			queued++;
+		}
+		size_t index = current_pool == this ? current_worker : next_worker++ % workers.size();
+		{
+			std::lock_guard<std::mutex> lock(workers[index]->mutex);
+			workers[index]->tasks.push_back(std::move(task));
+		}
+		work_available.notify_one();
+	}
+
+	// ждёт, пока не выполнятся все задачи, включая порождённые ими
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(idle_mutex);
+		all_done.wait(lock, [this]
+		{ return pending.load() == 0; });
+		if (failure)
+		{
+			std::exception_ptr error = failure;
+			failure = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONCURRENCY_WORK_STEALING_POOL_H
@@ -0,0 +1,100 @@
+#ifndef PROGC_SRC_CONNECTION_CONNECTION_EVENTS_H
+#define PROGC_SRC_CONNECTION_CONNECTION_EVENTS_H
+
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "../concurrency/shared_event.h"
+
+
+/*
+ Имена событий, которые будят читателей каждой стороны соединения. Лежат в начале сегмента:
+ каждая сторона записывает имя своего события, а отправитель звонит в событие другой стороны.
+ Имя читается другим процессом, пока его могут переписывать, поэтому рядом лежит поколение:
+ нечётное - имя пишется, чётное - записано целиком. Читатель сверяет поколение до и после копирования.
+ */
+struct EventNames
+{
+	static inline const size_t NAME_SIZE = 64;
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free,
+			"Event name generations are shared between processes and must be lock-free");
+
+	struct Name
+	{
+		std::atomic<uint32_t> generation;
+		char text[NAME_SIZE];
+	};
+
+	Name names[2]; // 0 - событие сервера, 1 - событие клиента
+};
+
+
+class ConnectionEvents
+{
+private:
+
+	EventNames* event_names = nullptr;
+	bool is_server = false;
+	mutable uint32_t peer_generation = 0; // поколение имени, по которому открыт peer_event
+	mutable std::unique_ptr<SharedEvent> peer_event;
+
+public:
+
+	void attach(EventNames* eventNames, bool isServer, bool clear)
+	{
+		event_names = eventNames;
+		is_server = isServer;
+		if (!clear)
+			return;
+		for (auto& name: event_names->names)
+		{
+			name.generation.store(0, std::memory_order_relaxed);
+			name.text[0] = '\0';
+		}
+	}
+
+	void subscribe(const SharedEvent& event) const
+	{
+		auto& name = event_names->names[is_server ? 0 : 1];
+		uint32_t generation = name.generation.load(std::memory_order_relaxed);
+		name.generation.store(generation + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		strncpy(name.text, event.getName().c_str(), EventNames::NAME_SIZE - 1);
+		name.text[EventNames::NAME_SIZE - 1] = '\0';
+		name.generation.store(generation + 2, std::memory_order_release);
+	}
+
+	// у другой стороны может смениться процесс (общий канал подключения), поэтому поколение сверяется каждый раз;
+	// имя, которое как раз переписывается, пропускается - новый читатель проверит соединение после подписки
+	void notifyPeer() const
+	{
+		const auto& name = event_names->names[is_server ? 1 : 0];
+		uint32_t generation = name.generation.load(std::memory_order_acquire);
+		if (generation == 0 || generation % 2 != 0)
+			return;
+		if (!peer_event || peer_generation != generation)
+		{
+			char text[EventNames::NAME_SIZE];
+			memcpy(text, name.text, sizeof(text));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (name.generation.load(std::memory_order_relaxed) != generation)
+				return;
+			text[EventNames::NAME_SIZE - 1] = '\0';
+			peer_generation = generation;
+			try
+			{ peer_event = std::make_unique<SharedEvent>(false, text); }
+			catch (...)
+			{
+				peer_event = nullptr;
+				return;
+			}
+		}
+		peer_event->notify();
+	}
+};
+
+
+#endif //PROGC_SRC_CONNECTION_CONNECTION_EVENTS_H
@@ -0,0 +1,460 @@
+#ifndef PROGC_SRC_CONNECTION_SOCKET_CONNECTION_H
+#define PROGC_SRC_CONNECTION_SOCKET_CONNECTION_H
+
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "./connection.h"
+#include "../extensions/serializable.h"
+#include "../data_types/shared_object.h"
+
+
+/*
+ Адрес сокета в виде строки:
+ unix:/путь/к/сокету - Unix-domain сокет
+ tcp:хост:порт - TCP (например, tcp:127.0.0.1:7000)
+ */
+struct SocketAddress
+{
+	std::string text;
+	bool is_unix = true;
+	std::string path;
+	std::string host;
+	std::string port;
+
+	static SocketAddress parse(const std::string& address)
+	{
+		SocketAddress result;
+		result.text = address;
+		if (address.rfind("unix:", 0) == 0)
+		{
+			result.path = address.substr(5);
+		}
+		else if (address.rfind("tcp:", 0) == 0)
+		{
+			size_t colon = address.rfind(':');
+			if (colon <= 4)
+				throw std::runtime_error("Invalid socket address: " + address);
+			result.is_unix = false;
+			result.host = address.substr(4, colon - 4);
+			result.port = address.substr(colon + 1);
+		}
+		else
+		{
+			throw std::runtime_error("Invalid socket address: " + address);
+		}
+		return result;
+	}
+
+	// открывает сокет и делает bind + listen (listen = true) или connect
+	int open(bool listen) const
+	{
+		int descriptor;
+		if (is_unix)
+		{
+			sockaddr_un address{};
+			address.sun_family = AF_UNIX;
+			if (path.length() >= sizeof(address.sun_path))
+				throw std::runtime_error("Socket path is too long: " + path);
+			strcpy(address.sun_path, path.c_str());
+			descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (descriptor < 0)
+				throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+			if (listen)
+				unlink(path.c_str());
+			int result = listen
+						 ? bind(descriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+						 : connect(descriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+			if (result < 0)
+			{
+				std::string error = strerror(errno);
+				close(descriptor);
+				throw std::runtime_error("Unable to open socket " + path + ": " + error);
+			}
+		}
+		else
+		{
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = listen ? AI_PASSIVE : 0;
+			addrinfo* addresses;
+			if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+				throw std::runtime_error("Unable to resolve " + host + ":" + port);
+			descriptor = socket(addresses->ai_family, addresses->ai_socktype | SOCK_CLOEXEC, addresses->ai_protocol);
+			if (descriptor < 0)
+			{
+				freeaddrinfo(addresses);
+				throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+			}
+			int on = 1;
+			setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			int result = listen
+						 ? bind(descriptor, addresses->ai_addr, addresses->ai_addrlen)
+						 : connect(descriptor, addresses->ai_addr, addresses->ai_addrlen);
+			freeaddrinfo(addresses);
+			if (result < 0)
+			{
+				std::string error = strerror(errno);
+				close(descriptor);
+				throw std::runtime_error("Unable to open socket " + host + ":" + port + ": " + error);
+			}
+		}
+		if (listen && ::listen(descriptor, SOMAXCONN) < 0)
+		{
+			std::string error = strerror(errno);
+			close(descriptor);
+			throw std::runtime_error("Unable to listen on socket: " + error);
+		}
+		return descriptor;
+	}
+};
+
+
+/*
+ Соединение через потоковый сокет (Unix-domain или TCP), поэтому стороны могут жить на разных машинах.
+ Кадр передаётся с префиксом длины: | uint32_t длина кадра | кадр (SharedObject) |
+ Чтение неблокирующее: hasMessage забирает из сокета всё, что пришло, и проверяет, собран ли первый кадр.
+ Другая сторона не обязательно своя: длина сверх MAX_FRAME_SIZE или кадр, чей заголовок не сходится
+ с префиксом длины, закрывает соединение - поток после них уже не разобрать.
+ Запись со стороны сервера (buffered) тоже не ждёт другую сторону: что не влезло в сокет, копится в outbound
+ и дописывается следующими отправками и flush. Кто не забирает ответы дольше WRITE_TIMEOUT
+ или набрал больше OUTBOUND_LIMIT, отключается - иначе он держал бы поток пула.
+ */
+
+
+class SocketConnection : public Connection
+{
+public:
+
+	using LengthPrefix = uint32_t;
+
+	static inline const size_t READ_CHUNK_SIZE = 64 * 1024;
+	static inline const size_t DEFAULT_CAPACITY = 64;
+	static inline const size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+	static inline const size_t INBOUND_LIMIT = 1024 * 1024; // сверх этого из сокета не читается, пока есть целый кадр
+	static inline const size_t OUTBOUND_LIMIT = 2 * MAX_FRAME_SIZE;
+	static inline const std::chrono::seconds WRITE_TIMEOUT{ 10 };
+
+private:
+
+	const int descriptor;
+	mutable std::string inbound; // принятые, но ещё не разобранные байты
+	mutable size_t consumed = 0; // сколько байт в начале inbound уже прочитано через popMessage
+	mutable std::atomic<bool> closed{ false };
+	const bool buffered;
+	mutable std::mutex outbound_mutex; // пишут потоки пула, дописывает главный поток
+	mutable std::string outbound; // ещё не принятые сокетом байты (только buffered)
+	mutable std::atomic<bool> has_outbound{ false };
+	mutable std::chrono::steady_clock::time_point outbound_since; // когда сокет последний раз принял байты из outbound
+
+	size_t frameLength() const
+	{
+		LengthPrefix length;
+		memcpy(&length, inbound.data() + consumed, sizeof(length));
+		return length;
+	}
+
+	// первый кадр собран целиком и сходится со своим префиксом
+	bool hasFrame() const
+	{
+		size_t available = inbound.length() - consumed;
+		if (available < sizeof(LengthPrefix))
+			return false;
+		size_t length = frameLength();
+		if (length > MAX_FRAME_SIZE)
+		{
+			reject();
+			return false;
+		}
+		if (available - sizeof(LengthPrefix) < length)
+			return false;
+		if (SharedObject::frameSize(inbound.data() + consumed + sizeof(LengthPrefix), length) != length)
+		{
+			reject();
+			return false;
+		}
+		return true;
+	}
+
+	// прислали не кадр: непрочитанное выбрасывается, соединение закрывается с обеих сторон
+	void reject() const
+	{
+		inbound.clear();
+		consumed = 0;
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		disconnect();
+	}
+
+	// пишет, сколько примет сокет, не дожидаясь другой стороны; возвращает, сколько записано
+	size_t writeSome(const char* data, size_t length) const
+	{
+		size_t total = 0;
+		while (total < length)
+		{
+			ssize_t written = send(descriptor, data + total, length - total, MSG_NOSIGNAL);
+			if (written >= 0)
+			{
+				total += written;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EPIPE || errno == ECONNRESET)
+			{
+				// другая сторона ушла - ответ доставлять некому
+				closed = true;
+				return length;
+			}
+			throw std::runtime_error("Unable to send to " + connectionName + ": " + strerror(errno));
+		}
+		return total;
+	}
+
+	void writeAll(const char* data, size_t length) const
+	{
+		while (true)
+		{
+			size_t written = writeSome(data, length);
+			data += written;
+			length -= written;
+			if (length == 0)
+				return;
+			// буфер сокета заполнен - ждём, пока другая сторона его прочитает
+			pollfd descriptorPoll{ descriptor, POLLOUT, 0 };
+			poll(&descriptorPoll, 1, -1);
+		}
+	}
+
+	// вызывается под outbound_mutex
+	void flushOutbound() const
+	{
+		try
+		{
+			size_t written = writeSome(outbound.data(), outbound.size());
+			if (written > 0)
+				outbound_since = std::chrono::steady_clock::now();
+			outbound.erase(0, written);
+		}
+		catch (const std::exception&)
+		{
+			disconnect();
+		}
+		if (closed)
+			outbound.clear();
+		else if (!outbound.empty() && (outbound.size() > OUTBOUND_LIMIT
+				|| std::chrono::steady_clock::now() - outbound_since > WRITE_TIMEOUT))
+			disconnect();
+		has_outbound = !outbound.empty();
+	}
+
+	// вызывается под outbound_mutex
+	void disconnect() const
+	{
+		closed = true;
+		outbound.clear();
+		shutdown(descriptor, SHUT_RDWR);
+	}
+
+public:
+
+	// забирает уже открытый сокет (из accept или SocketAddress::open)
+	// buffered - отправка не ждёт другую сторону (сокеты сервера, см. flush)
+	SocketConnection(int socketDescriptor, const std::string& name, bool buffered = false)
+			: descriptor(socketDescriptor), buffered(buffered)
+	{
+		Connection::connectionName = name;
+		fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+		int on = 1;
+		setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // для Unix-сокета просто не сработает
+	}
+
+	static std::unique_ptr<SocketConnection> connect(const SocketAddress& address)
+	{
+		return std::make_unique<SocketConnection>(address.open(false), address.text);
+	}
+
+	~SocketConnection() override
+	{
+		close(descriptor);
+	}
+
+	int getDescriptor() const
+	{
+		return descriptor;
+	}
+
+	// другая сторона закрыла соединение
+	bool isClosed() const
+	{
+		return closed;
+	}
+
+	bool hasMessage(int) const override
+	{
+		if (hasFrame())
+			return true;
+		if (consumed > 0)
+		{
+			inbound.erase(0, consumed);
+			consumed = 0;
+		}
+		while (!closed && (inbound.length() < INBOUND_LIMIT || !hasFrame()))
+		{
+			size_t size = inbound.length();
+			inbound.resize(size + READ_CHUNK_SIZE);
+			ssize_t received = recv(descriptor, inbound.data() + size, READ_CHUNK_SIZE, 0);
+			inbound.resize(size + std::max<ssize_t>(received, 0));
+			if (received > 0)
+				continue;
+			if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				closed = true;
+			if (received < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		return hasFrame();
+	}
+
+	// кадр действителен до popMessage
+	const char* receiveMessage() const override
+	{
+		return inbound.data() + consumed + sizeof(LengthPrefix);
+	}
+
+	size_t receiveSize() const override
+	{
+		return frameLength();
+	}
+
+	void popMessage() const override
+	{
+		consumed += sizeof(LengthPrefix) + frameLength();
+	}
+
+	size_t capacity() const override
+	{
+		return DEFAULT_CAPACITY;
+	}
+
+	void sendMessage(const Serializable& data) const override
+	{
+		size_t frameSize = data.serializedSize();
+		std::vector<char> buffer(sizeof(LengthPrefix) + frameSize);
+		auto length = static_cast<LengthPrefix>(frameSize);
+		memcpy(buffer.data(), &length, sizeof(length));
+		data.serializeTo(buffer.data() + sizeof(LengthPrefix));
+		if (!buffered)
+		{
+			writeAll(buffer.data(), buffer.size());
+			return;
+		}
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		if (closed)
+			return;
+		if (outbound.empty())
+			outbound_since = std::chrono::steady_clock::now();
+		outbound.append(buffer.data(), buffer.size());
+		flushOutbound();
+	}
+
+	bool hasOutbound() const
+	{
+		return has_outbound;
+	}
+
+	// дописывает накопленное; зовётся, пока hasOutbound
+	void flush() const
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		flushOutbound();
+	}
+
+	// ждёт, пока на одном из сокетов не появятся данные (или до таймаута)
+	static void waitReadable(const std::vector<const SocketConnection*>& connections,
+			std::chrono::milliseconds timeout)
+	{
+		std::vector<pollfd> descriptors;
+		for (auto connection: connections)
+		{
+			if (connection->hasFrame())
+				return;
+			descriptors.push_back({ connection->descriptor, POLLIN, 0 });
+		}
+		poll(descriptors.data(), descriptors.size(), static_cast<int>(timeout.count()));
+	}
+
+	SocketConnection(const SocketConnection&) = delete;
+
+	SocketConnection& operator=(const SocketConnection&) = delete;
+};
+
+
+/*
+ Слушающий сокет сервера
+ */
+
+
+class SocketListener
+{
+private:
+
+	const int descriptor;
+	const std::string address;
+	size_t accepted = 0;
+
+public:
+
+	explicit SocketListener(const std::string& listenAddress)
+			: descriptor(SocketAddress::parse(listenAddress).open(true)), address(listenAddress)
+	{
+		fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+	}
+
+	~SocketListener()
+	{
+		close(descriptor);
+		SocketAddress socketAddress = SocketAddress::parse(address);
+		if (socketAddress.is_unix)
+			unlink(socketAddress.path.c_str());
+	}
+
+	int getDescriptor() const
+	{
+		return descriptor;
+	}
+
+	// nullptr - новых подключений нет
+	std::unique_ptr<SocketConnection> accept()
+	{
+		int connectionDescriptor = accept4(descriptor, nullptr, nullptr, SOCK_CLOEXEC);
+		if (connectionDescriptor < 0)
+			return nullptr;
+		accepted++;
+		return std::make_unique<SocketConnection>(connectionDescriptor, address + "#" + std::to_string(accepted), true);
+	}
+
+	SocketListener(const SocketListener&) = delete;
+
+	SocketListener& operator=(const SocketListener&) = delete;
+};
+
+
+#endif //PROGC_SRC_CONNECTION_SOCKET_CONNECTION_H
@@ -0,0 +1,131 @@
+#ifndef PROGC_SRC_DATA_TYPES_BATCH_H
+#define PROGC_SRC_DATA_TYPES_BATCH_H
+
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "./contest_info.h"
+#include "./request_object.h"
+#include "./shared_object.h"
+#include "./wire_format.h"
+
+
+/*
+ Пачка операций над записями одной таблицы - данные запроса с кодом BATCH:
+ | varint число операций | код (1 байт) | varint ключ записи | varint длина + данные | ... |
+ Ключ (ContestInfo::hashcode) кладёт клиент, по нему сервер делит пачку между хранилищами, не разбирая записей.
+ Ответ: | varint число | код ответа (1 байт) | varint длина + данные | ... | - в порядке операций.
+ */
+
+
+class Batch
+{
+public:
+
+	struct Operation
+	{
+		RequestObject<ContestInfo>::RequestCode code;
+		uint64_t key_hash;
+		std::string_view data;
+	};
+
+	struct Result
+	{
+		int code = SharedObject::RequestResponseCode::ERROR;
+		std::string data = SharedObject::NULL_DATA;
+	};
+
+	// операции, которые можно класть в пачку: к одной записи
+	static bool isKeyOperation(RequestObject<ContestInfo>::RequestCode code)
+	{
+		return code == RequestObject<ContestInfo>::RequestCode::ADD
+			   || code == RequestObject<ContestInfo>::RequestCode::CONTAINS
+			   || code == RequestObject<ContestInfo>::RequestCode::REMOVE
+			   || code == RequestObject<ContestInfo>::RequestCode::GET_KEY;
+	}
+
+	static std::string encode(const std::vector<Operation>& operations)
+	{
+		size_t size = WireFormat::varintSize(operations.size());
+		for (const auto& operation: operations)
+			size += 1 + WireFormat::varintSize(operation.key_hash) + WireFormat::varintSize(operation.data.size())
+					+ operation.data.size();
+		std::string result(size, '\0');
+		char* ptr = WireFormat::writeVarint(&result[0], operations.size());
+		for (const auto& operation: operations)
+		{
+			*ptr++ = static_cast<char>(operation.code);
+			ptr = WireFormat::writeVarint(ptr, operation.key_hash);
+			ptr = WireFormat::writeVarint(ptr, operation.data.size());
+			memcpy(ptr, operation.data.data(), operation.data.size());
+			ptr += operation.data.size();
+		}
+		return result;
+	}
+
+	// данные операций указывают в batch
+	static std::vector<Operation> decode(std::string_view batch)
+	{
+		const char* ptr = batch.data();
+		const char* end = ptr + batch.size();
+		size_t count = WireFormat::readVarint(ptr);
+		std::vector<Operation> operations;
+		operations.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (ptr >= end)
+				throw std::runtime_error("Malformed batch");
+			auto code = static_cast<RequestObject<ContestInfo>::RequestCode>(static_cast<uint8_t>(*ptr++));
+			uint64_t keyHash = WireFormat::readVarint(ptr);
+			size_t length = WireFormat::readVarint(ptr);
+			if (length > static_cast<size_t>(end - ptr))
+				throw std::runtime_error("Malformed batch");
+			operations.push_back({ code, keyHash, std::string_view(ptr, length) });
+			ptr += length;
+		}
+		return operations;
+	}
+
+	static std::string encodeResults(const std::vector<Result>& results)
+	{
+		size_t size = WireFormat::varintSize(results.size());
+		for (const auto& result: results)
+			size += 1 + WireFormat::varintSize(result.data.size()) + result.data.size();
+		std::string encoded(size, '\0');
+		char* ptr = WireFormat::writeVarint(&encoded[0], results.size());
+		for (const auto& result: results)
+		{
+			*ptr++ = static_cast<char>(result.code);
+			ptr = WireFormat::writeVarint(ptr, result.data.size());
+			memcpy(ptr, result.data.data(), result.data.size());
+			ptr += result.data.size();
+		}
+		return encoded;
+	}
+
+	static std::vector<Result> decodeResults(std::string_view encoded)
+	{
+		const char* ptr = encoded.data();
+		const char* end = ptr + encoded.size();
+		size_t count = WireFormat::readVarint(ptr);
+		std::vector<Result> results;
+		results.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (ptr >= end)
+				throw std::runtime_error("Malformed batch response");
+			int code = static_cast<uint8_t>(*ptr++);
+			size_t length = WireFormat::readVarint(ptr);
+			if (length > static_cast<size_t>(end - ptr))
+				throw std::runtime_error("Malformed batch response");
+			results.push_back({ code, std::string(ptr, length) });
+			ptr += length;
+		}
+		return results;
+	}
+};
+
+
+#endif //PROGC_SRC_DATA_TYPES_BATCH_H
@@ -0,0 +1,87 @@
+#ifndef PROGC_SRC_DATA_TYPES_FRAME_PACK_H
+#define PROGC_SRC_DATA_TYPES_FRAME_PACK_H
+
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include "../extensions/serializable.h"
+#include "./shared_object.h"
+#include "./wire_format.h"
+
+
+/*
+ Несколько кадров в данных одного кадра PACKED: | varint длина | кадр | varint длина | кадр | ... |
+ Сервер пакует запросы, накопившиеся у хранилища, а хранилище - ответы на них, так что
+ слот соединения, уведомление и проход читателя приходятся на пачку, а не на каждый запрос.
+ Кадры внутри - обычные, каждый со своим номером запроса.
+ */
+
+
+class FramePack
+{
+private:
+
+	std::string frames;
+	size_t count = 0;
+
+public:
+
+	// кадр пишется сразу в буфер пачки
+	void add(const Serializable& frame)
+	{
+		size_t size = frame.serializedSize();
+		size_t offset = frames.size();
+		frames.resize(offset + WireFormat::MAX_VARINT_SIZE + size);
+		char* ptr = WireFormat::writeVarint(&frames[offset], size);
+		frame.serializeTo(ptr);
+		frames.resize(ptr - frames.data() + size);
+		count++;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	size_t bytes() const
+	{
+		return frames.size();
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	const std::string& getData() const
+	{
+		return frames;
+	}
+
+	void clear()
+	{
+		frames.clear();
+		count = 0;
+	}
+
+	// callback получает начало и длину каждого кадра; кадры указывают в data
+	// длина кадра в пачке должна совпасть с длиной по его заголовку, иначе пачке не верим
+	static void forEach(std::string_view data, const std::function<void(const char*, size_t)>& callback)
+	{
+		const char* ptr = data.data();
+		const char* end = ptr + data.size();
+		while (ptr < end)
+		{
+			uint64_t size;
+			if (!WireFormat::readVarint(ptr, end, size) || size > static_cast<size_t>(end - ptr)
+				|| SharedObject::frameSize(ptr, size) != size)
+				throw std::runtime_error("Malformed frame pack");
+			callback(ptr, size);
+			ptr += size;
+		}
+	}
+};
+
+
+#endif //PROGC_SRC_DATA_TYPES_FRAME_PACK_H
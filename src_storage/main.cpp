@@ -3,21 +3,27 @@
 
 
 const std::string CON_MEM_NAME = "con_mem";
-const std::string CON_MUTEX_NAME = "con_mutex";
 const int STORAGE_STATUS_CODE = 3;
 const int LOG_SERVER_STATUS_CODE = 4;
 const std::string LOG_MEM_NAME = "log_mem";
-const std::string LOG_MUTEX_NAME = "log_mutex";
+const size_t SPIN_COUNT = WaitStrategy::DEFAULT_SPIN_COUNT;
+const size_t YIELD_COUNT = WaitStrategy::DEFAULT_YIELD_COUNT;
 
 
-int main()
+// без аргументов - подключение через разделяемую память,
+// иначе argv[1] - адрес сервера (unix:/путь или tcp:хост:порт)
+int main(int argc, char* argv[])
 {
-	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME, LOG_MUTEX_NAME);
-	StorageProcessor storageProcessor(STORAGE_STATUS_CODE, CON_MEM_NAME, CON_MUTEX_NAME, serverLogger);
+	ServerLogger serverLogger(LOG_SERVER_STATUS_CODE, LOG_MEM_NAME);
+	std::unique_ptr<StorageProcessor> storageProcessor = argc > 1
+			? std::make_unique<StorageProcessor>(STORAGE_STATUS_CODE, SocketAddress::parse(argv[1]), serverLogger,
+					WaitStrategy(SPIN_COUNT, YIELD_COUNT))
+			: std::make_unique<StorageProcessor>(STORAGE_STATUS_CODE, CON_MEM_NAME, serverLogger,
+					WaitStrategy(SPIN_COUNT, YIELD_COUNT));
 	while (true)
 	{
-		storageProcessor.process();
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		storageProcessor->process();
+		storageProcessor->waitMessages();
 	}
 
 	return 0;
@@ -3,16 +3,30 @@
 
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/sync/named_mutex.hpp>
+#include <chrono>
 #include <thread>
+#include <random>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <tuple>
 #include "../../connection/connection.h"
 #include "../../connection/memory_connection.h"
+#include "../../connection/ring_connection.h"
+#include "../../connection/socket_connection.h"
+#include "../../connection/handshake.h"
+#include "../../concurrency/wait_strategy.h"
 #include "../processor.h"
 #include "../../data_types/shared_object.h"
 #include "../../data_types/contest_info.h"
 #include "../../collections/Map.h"
+#include "../../collections/consistent_hash_ring.h"
+#include "../../collections/migration_plan.h"
 #include "../../collections/BPlusTree/BPlusTreeMap.h"
 #include "../../data_types/request_object.h"
+#include "../../data_types/batch.h"
+#include "../../data_types/frame_pack.h"
 #include "../../loggers/server_logger/server_logger.h"
 
 
@@ -66,49 +80,83 @@ private:
 	const Connection* connection;
 	std::string connectionName;
 	ServerLogger& logger;
+	const SharedEvent* events = nullptr; // nullptr - подключение через сокеты
+	uint32_t events_seen = 0;
+	std::vector<const SocketConnection*> sockets;
+	WaitStrategy wait_strategy;
 
 	int storage_id;
-	const Connection* client_connection;
-	std::queue<RequestObject<ContestInfo>> toSend;
+
+	struct RecordKey
+	{
+		std::string database;
+		std::string schema;
+		std::string table;
+		int candidate_id;
+		int contest_id;
+	};
+
+	// ребалансировка: план и ключи диапазонов, которые хранилище отдаёт, по номеру диапазона
+	// записи остаются в дереве и обслуживаются, пока сервер не заберёт диапазон (MIGRATE_OUT)
+	std::optional<MigrationPlan> plan;
+	std::map<size_t, std::deque<RecordKey>> outgoing;
+	// отданные пачки, которые новые владельцы ещё не приняли: удаляются по MIGRATE_COMMIT,
+	// возвращаются в outgoing по MIGRATE_ABORT
+	std::map<size_t, std::vector<RecordKey>> unconfirmed;
+	// обход дерева под план: таблицы на момент плана и ключ, после которого продолжать текущую.
+	// Идёт частями между запросами, и план подтверждается, когда обход закончен
+	struct MigrationWalk
+	{
+		std::vector<std::tuple<std::string, std::string, std::string>> tables;
+		size_t table = 0;
+		std::optional<ContestInfo> after;
+		uint64_t correlation_id; // STORAGE_REBALANCE, на который ещё не ответили
+	};
+	std::optional<MigrationWalk> walk;
+	std::optional<FramePack> packed_responses; // ответы на запросы упакованного кадра, пока он разбирается
+	// от него отсчитывается срок запросов кадра; у упакованных он общий, и последним в пачке может не хватить времени
+	std::chrono::steady_clock::time_point received;
 
 public:
 
-	StorageProcessor(const int statusCode, const std::string& memNameForConnect,
-			const std::string& mutexNameForConnect, ServerLogger& serverLogger)
-			: this_status_code(statusCode), db(3, 3, stringComparer), logger(serverLogger)
+	static inline const size_t BATCH_BYTES_LIMIT = 8 * 1024; // пачка переноса должна помещаться в слот соединения
+	static inline const size_t WALK_STEP = 256; // записей за одну часть обхода под план
+
+	StorageProcessor(const int statusCode, const std::string& memNameForConnect, ServerLogger& serverLogger,
+			const WaitStrategy& waitStrategy = WaitStrategy())
+			: this_status_code(statusCode), db(3, 3, stringComparer), logger(serverLogger), wait_strategy(waitStrategy)
 	{
-		MemoryConnection connect_connection(false, memNameForConnect);
-		named_mutex mutex(open_only, mutexNameForConnect.c_str());
-		scoped_lock<named_mutex> lock(mutex);
-		connect_connection.sendMessage(SharedObject(this_status_code,
-				SharedObject::RequestResponseCode::GET_CONNECTION_STORAGE, SharedObject::NULL_DATA));
-		while (SharedObject::getStatusCode(connect_connection.receiveMessage()) == this_status_code)
-		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
-		auto data = SharedObject::deserialize(connect_connection.receiveMessage());
-		auto memNameStorage = data.getData();
+		events = new SharedEvent(true, memNameForConnect + "_events_storage" + std::to_string(std::random_device()()));
+		auto memNameStorage = requestConnection(memNameForConnect, this_status_code,
+				SharedObject::RequestResponseCode::GET_CONNECTION_STORAGE, *events, wait_strategy);
 		if (!memNameStorage)
 			throw std::runtime_error("Unable to establish a connection");
-		connection = new MemoryConnection(false, memNameStorage.value());
+		connection = new RingConnection(false, memNameStorage.value());
+		connection->setReceiveEvent(*events);
 		storage_id = std::stoi(memNameStorage->substr(7));
+		connectionName = memNameStorage.value();
 
-		connect_connection.sendMessage(SharedObject(this_status_code,
-				SharedObject::RequestResponseCode::GET_CONNECTION_CLIENT, SharedObject::NULL_DATA));
-		while (SharedObject::getStatusCode(connect_connection.receiveMessage()) == this_status_code)
-		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
-		auto data1 = SharedObject::deserialize(connect_connection.receiveMessage());
-		auto memNameClient = data1.getData();
-		if (!memNameClient)
-			throw std::runtime_error("Unable to establish a connection");
-		client_connection = new MemoryConnection(false, memNameClient.value());
+		std::stringstream log;
+		log << "[STORAGE] Get connection: " << connectionName << std::endl;
+		logger.logSync(log.str(), logger::severity::debug);
+		std::cout << log.str();
+	}
+
+	// подключение к серверу через сокет (unix:/путь или tcp:хост:порт), сервер может быть на другой машине
+	StorageProcessor(const int statusCode, const SocketAddress& serverAddress, ServerLogger& serverLogger,
+			const WaitStrategy& waitStrategy = WaitStrategy())
+			: this_status_code(statusCode), db(3, 3, stringComparer), logger(serverLogger), wait_strategy(waitStrategy)
+	{
+		auto storageSocket = SocketConnection::connect(serverAddress);
+		std::string storageName = socketHandshake(*storageSocket, SharedObject::GET_CONNECTION_STORAGE);
+		storage_id = std::stoi(storageName.substr(7));
 
-		connectionName = memNameStorage.value() + " | " + memNameClient.value();
+		sockets = { storageSocket.get() };
+		connection = storageSocket.release();
 
+		connectionName = storageName;
 		std::stringstream log;
-		log << "[STORAGE] Get connection: " << connectionName << std::endl;
+		log << "[STORAGE] Get socket connection: " << connectionName << std::endl;
 		logger.logSync(log.str(), logger::severity::debug);
 		std::cout << log.str();
 	}
@@ -116,305 +164,678 @@ public:
 	~StorageProcessor() override
 	{
 		delete connection;
-		delete client_connection;
+		delete events;
+	}
+
+	// спит, пока сервер не пришлёт кадр (или до таймаута)
+	// через сокеты крутиться нечему (проверка - системный вызов), поэтому сразу poll
+	void waitMessages()
+	{
+		if (walk)
+			return; // обход под план продолжается в следующем process
+		if (events)
+			wait_strategy.wait(*events, events_seen);
+		else
+			SocketConnection::waitReadable(sockets, SharedEvent::IDLE_TIMEOUT);
+		if (wait_strategy.reportDue())
+		{
+			std::stringstream log;
+			log << "[" << connectionName << "] Wait statistics: " << wait_strategy.getPrint() << std::endl;
+			logger.log(log.str(), logger::severity::debug);
+		}
 	}
 
 	void process() override
 	{
+		if (events)
+			events_seen = events->sequence();
 		logger.process();
 
-		if ((SharedObject::getStatusCode(client_connection->receiveMessage()) != this_status_code))
+		// сервер может прислать несколько запросов подряд, ответы несут их correlation id
+		while (connection->hasMessage(this_status_code))
 		{
-			if (!toSend.empty())
-			{
-				client_connection->sendMessage(SharedObject(this_status_code,
-						SharedObject::RequestResponseCode::REQUEST, toSend.front()));
-				toSend.pop();
-			}
+			SharedObject::View message(connection->receiveMessage(), connection->receiveSize());
+			received = std::chrono::steady_clock::now();
+			if (message.getRequestResponseCode() == SharedObject::RequestResponseCode::PACKED)
+				processPacked(message);
+			else
+				processMessage(message);
+			connection->popMessage();
 		}
+		if (walk)
+			continueMigration();
+	}
 
-		if ((SharedObject::getStatusCode(connection->receiveMessage()) != this_status_code))
-		{
-			SharedObject message = SharedObject::deserialize(connection->receiveMessage());
+private:
 
-			std::stringstream log;
-			log << "[" << connectionName << "] Receive:" << std::endl << message.getPrint();
-			std::cout << log.str() << std::endl;
-			logger.log(log.str(), logger::severity::debug);
+	std::string socketHandshake(const SocketConnection& socket, SharedObject::RequestResponseCode request)
+	{
+		socket.sendMessage(SharedObject(this_status_code, request, SharedObject::NULL_DATA));
+		while (!socket.hasMessage(this_status_code))
+		{
+			if (socket.isClosed())
+				throw std::runtime_error("Unable to establish a connection");
+			SocketConnection::waitReadable({ &socket }, SharedEvent::IDLE_TIMEOUT);
+		}
+		auto data = SharedObject::deserialize(socket.receiveMessage(), socket.receiveSize());
+		socket.popMessage();
+		auto name = data.getData();
+		if (!name)
+			throw std::runtime_error("Unable to establish a connection");
+		return name.value();
+	}
 
-			auto messageData = message.getData();
+	// true - записи ещё не было; недостающие база, схема и таблица создаются
+	bool addRecord(const std::string& databaseName, const std::string& schemaName, const std::string& tableName,
+			const ContestInfo& data)
+	{
+		auto schemasOpt = db.get(databaseName);
+		if (!schemasOpt)
+		{
+			auto schemas = std::make_shared<BPlusTreeMap<std::string, std::shared_ptr<BPlusTreeMap<std::string,
+					std::shared_ptr<BPlusTreeMap<ContestInfo, Null>>>>>>(3, 3, stringComparer);
+			if (!db.add(databaseName, schemas))
+				throw std::runtime_error("Can't add database");
+			schemasOpt.emplace(schemas);
+		}
+		auto schemas = schemasOpt.value();
 
-			if (message.getRequestResponseCode() == SharedObject::STORAGE_REBALANCE)
-			{
-				const char* ptr = messageData.value().c_str();
-				size_t storage_count = *reinterpret_cast<const size_t*>(ptr);
+		auto tablesOpt = schemas->get(schemaName);
+		if (!tablesOpt)
+		{
+			auto tables = std::make_shared<BPlusTreeMap<std::string,
+					std::shared_ptr<BPlusTreeMap<ContestInfo, Null>>>>(3, 3, stringComparer);
+			if (!schemas->add(schemaName, tables))
+				throw std::runtime_error("Can't add schema");
+			tablesOpt.emplace(tables);
+		}
+		auto tables = tablesOpt.value();
 
-				std::queue<RequestObject<ContestInfo>> toDelete;
+		auto tableOpt = tables->get(tableName);
+		if (!tableOpt)
+		{
+			auto table = std::make_shared<BPlusTreeMap<ContestInfo, Null>>(3, 3, contestInfoComparer);
+			if (!tables->add(tableName, table))
+				throw std::runtime_error("Can't add table");
+			tableOpt.emplace(table);
+		}
+		auto table = tableOpt.value();
 
-				if (db.size() > 0)
-				{
-					auto dbIterator = db.begin();
-					while (true)
-					{
-						auto dbPair = dbIterator.entry;
-						std::string dbName = *(dbPair->key);
-						auto schema = dbPair->value->get();
-						if (schema->size() > 0)
-						{
-							auto schemaIterator = schema->begin();
-							while (true)
-							{
-								auto schemaPair = schemaIterator.entry;
-								std::string schemaName = *(schemaPair->key);
-								auto table = schemaPair->value->get();
-								if (table->size() > 0)
-								{
-									auto tableIterator = table->begin();
-									while (true)
-									{
-										auto tablePair = tableIterator.entry;
-										std::string tableName = *(tablePair->key);
-										auto data = tablePair->value->get();
-										if (data->size() > 0)
-										{
-											auto dataIterator = data->begin();
-											while (true)
-											{
-												ContestInfo* contestInfo = dataIterator.entry->key;
-												if (contestInfo->hashcode() % storage_count != storage_id)
-												{
-													toSend.emplace(RequestObject<ContestInfo>::RequestCode::ADD,
-															contestInfo->serialize(), dbName, schemaName, tableName);
-													toDelete.emplace(RequestObject<ContestInfo>::RequestCode::ADD,
-															ContestInfo::get_obj_for_search(
-																	contestInfo->getCandidateId(),
-																	contestInfo->getContestId()), dbName, schemaName,
-															tableName);
-
-													std::cout << "Removed for rebalancing: " << contestInfo->serialize() << std::endl << std::endl;
-												}
-
-												if (dataIterator == data->end())
-													break;
-												dataIterator += 1;
-											}
-										}
-
-										if (tableIterator == table->end())
-											break;
-										tableIterator += 1;
-									}
-								}
-								if (schemaIterator == schema->end())
-									break;
-								schemaIterator += 1;
-							}
-						}
-						if (dbIterator == db.end())
-							break;
-						dbIterator += 1;
-					}
-				}
+		if (!table->add(data, Null::value()))
+			return false;
+		// запись в отдаваемый диапазон должна уехать вместе с остальными
+		trackOutgoing(databaseName, schemaName, tableName, data);
+		return true;
+	}
 
-				connection->sendMessage(SharedObject(this_status_code,
-						SharedObject::RequestResponseCode::OK, SharedObject::NULL_DATA));
+	std::shared_ptr<BPlusTreeMap<ContestInfo, Null>> findTable(const std::string& databaseName,
+			const std::string& schemaName, const std::string& tableName)
+	{
+		auto schemas = db.get(databaseName);
+		if (!schemas)
+			return nullptr;
+		auto tables = schemas.value()->get(schemaName);
+		if (!tables)
+			return nullptr;
+		auto table = tables.value()->get(tableName);
+		if (!table)
+			return nullptr;
+		return table.value();
+	}
 
-				while (!toDelete.empty())
+	void forEachTable(const std::function<void(const std::string&, const std::string&, const std::string&)>& callback)
+	{
+		if (db.size() == 0)
+			return;
+		auto dbIterator = db.begin();
+		while (true)
+		{
+			auto dbPair = dbIterator.entry;
+			std::string dbName = *(dbPair->key);
+			auto schema = dbPair->value->get();
+			if (schema->size() > 0)
+			{
+				auto schemaIterator = schema->begin();
+				while (true)
 				{
-					auto request = toDelete.front();
-					auto schemas = db.get(request.getDatabase());
-					if (schemas)
+					auto schemaPair = schemaIterator.entry;
+					std::string schemaName = *(schemaPair->key);
+					auto table = schemaPair->value->get();
+					if (table->size() > 0)
 					{
-						auto tables = schemas.value()->get(request.getSchema());
-						if (tables)
+						auto tableIterator = table->begin();
+						while (true)
 						{
-							auto table = tables.value()->get(request.getTable());
-							if (table)
-							{
-								table.value()->remove(ContestInfo::deserialize(request.getData()));
-							}
+							callback(dbName, schemaName, *(tableIterator.entry->key));
+
+							if (tableIterator == table->end())
+								break;
+							tableIterator += 1;
 						}
 					}
-					toDelete.pop();
+					if (schemaIterator == schema->end())
+						break;
+					schemaIterator += 1;
 				}
-				return;
 			}
+			if (dbIterator == db.end())
+				break;
+			dbIterator += 1;
+		}
+	}
 
-			if (!messageData || message.getRequestResponseCode() != SharedObject::RequestResponseCode::REQUEST)
-			{
-				connection->sendMessage(SharedObject(this_status_code, SharedObject::RequestResponseCode::ERROR,
-						SharedObject::NULL_DATA));
-				return;
-			}
-			auto request = RequestObject<ContestInfo>::deserialize(messageData.value());
-			std::string response = SharedObject::NULL_DATA;
+	/*
+	 Запоминает ключи диапазонов, которые это хранилище отдаёт как источник; сами записи пока остаются.
+	 Копии остальных меняющих владельцев диапазонов удаляются: пока диапазон не перенесён,
+	 запросы к нему идут только к источнику, а новые владельцы получат от него все записи.
+	 Записи перебирает обход (continueMigration) по WALK_STEP за process, а не весь сразу;
+	 сервер начинает перенос, только когда все хранилища подтвердили план, т.е. закончили обход.
+	 Записи, добавленные во время обхода, попадают в outgoing через trackOutgoing.
+	 */
+	void startMigration(MigrationPlan newPlan, uint64_t correlationId)
+	{
+		// прежний план заменён, его подтверждение серверу уже ни к чему не обязывает
+		if (walk)
+			respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::OK,
+					SharedObject::NULL_DATA, walk->correlation_id));
+		plan.emplace(std::move(newPlan));
+		outgoing.clear();
+		unconfirmed.clear();
+		for (size_t range = 0; range < plan->getRanges().size(); range++)
+		{
+			if (plan->getRanges()[range].source() == static_cast<size_t>(storage_id))
+				outgoing[range];
+		}
 
-			switch (request.getRequestCode())
+		walk.emplace();
+		walk->correlation_id = correlationId;
+		forEachTable([&](const std::string& dbName, const std::string& schemaName, const std::string& tableName)
+		{
+			walk->tables.emplace_back(dbName, schemaName, tableName);
+		});
+	}
+
+	// следующие WALK_STEP записей обхода под план
+	void continueMigration()
+	{
+		std::vector<RecordKey> toDelete;
+		while (walk->table < walk->tables.size())
+		{
+			const auto& [dbName, schemaName, tableName] = walk->tables[walk->table];
+			auto table = findTable(dbName, schemaName, tableName);
+			auto entries = table ? table->entriesAfter(walk->after ? &walk->after.value() : nullptr, WALK_STEP)
+								 : std::vector<Map<ContestInfo, Null>::Pair>();
+			if (entries.empty())
 			{
-			case RequestObject<ContestInfo>::ADD:
+				walk->table++;
+				walk->after.reset();
+				continue;
+			}
+			for (const auto& entry: entries)
 			{
-				ContestInfo data = ContestInfo::deserialize(request.getData());
-				auto schemasOpt = db.get(request.getDatabase());
-				if (!schemasOpt)
-				{
-					auto schemas = std::make_shared<BPlusTreeMap<std::string, std::shared_ptr<BPlusTreeMap<std::string,
-							std::shared_ptr<BPlusTreeMap<ContestInfo, Null>>>>>>(3, 3, stringComparer);
-					if (!db.add(request.getDatabase(), schemas))
-						throw std::runtime_error("Can't add database");
-					schemasOpt.emplace(schemas);
-				}
-				auto schemas = schemasOpt.value();
+				const ContestInfo& record = entry.getKey();
+				size_t range = plan->rangeFor(record.hashcode());
+				if (range == MigrationPlan::NONE)
+					continue;
+				if (outgoing.count(range))
+					outgoing[range].push_back({ dbName, schemaName, tableName, record.getCandidateId(),
+												record.getContestId() });
+				else
+					toDelete.push_back({ dbName, schemaName, tableName, record.getCandidateId(),
+										 record.getContestId() });
+			}
+			// пары указывают в дерево, поэтому ключ копируется до удалений
+			walk->after = entries.back().getKey();
+			break;
+		}
+		for (const auto& key: toDelete)
+		{
+			if (auto table = findTable(key.database, key.schema, key.table))
+				table->remove(ContestInfo::get_obj_for_search(key.candidate_id, key.contest_id));
+		}
+		if (walk->table < walk->tables.size())
+			return;
+
+		respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::OK,
+				SharedObject::NULL_DATA, walk->correlation_id));
+		walk.reset();
+		if (outgoing.empty())
+			plan.reset();
+	}
 
-				auto tablesOpt = schemas->get(request.getSchema());
-				if (!tablesOpt)
-				{
-					auto tables = std::make_shared<BPlusTreeMap<std::string,
-							std::shared_ptr<BPlusTreeMap<ContestInfo, Null>>>>(3, 3, stringComparer);
-					if (!schemas->add(request.getSchema(), tables))
-						throw std::runtime_error("Can't add schema");
-					tablesOpt.emplace(tables);
-				}
-				auto tables = tablesOpt.value();
+	void trackOutgoing(const std::string& databaseName, const std::string& schemaName, const std::string& tableName,
+			const ContestInfo& record)
+	{
+		if (!plan)
+			return;
+		auto keys = outgoing.find(plan->rangeFor(record.hashcode()));
+		if (keys != outgoing.end())
+			keys->second.push_back({ databaseName, schemaName, tableName, record.getCandidateId(),
+									 record.getContestId() });
+	}
 
-				auto tableOpt = tables->get(request.getTable());
-				if (!tableOpt)
-				{
-					auto table = std::make_shared<BPlusTreeMap<ContestInfo, Null>>(3, 3, contestInfoComparer);
-					if (!tables->add(request.getTable(), table))
-						throw std::runtime_error("Can't add table");
-					tableOpt.emplace(table);
-				}
-				auto table = tableOpt.value();
+	/*
+	 | varint диапазон | varint не больше записей | ->
+	 | varint осталось записей | varint записей в пачке | varint длина | RequestObject ADD | ... |
+	 Отданные записи остаются в дереве до MIGRATE_COMMIT: пока диапазон переносится, сервер не шлёт к нему запросов.
+	 nullopt - запрос обрезан.
+	 */
+	std::optional<std::string> migrateOut(std::string_view request)
+	{
+		const char* ptr = request.data();
+		const char* requestEnd = ptr + request.size();
+		uint64_t range;
+		uint64_t limit;
+		if (!WireFormat::readVarint(ptr, requestEnd, range) || !WireFormat::readVarint(ptr, requestEnd, limit))
+			return std::nullopt;
+
+		std::string records;
+		size_t count = 0;
+		auto keys = outgoing.find(range);
+		while (keys != outgoing.end() && !keys->second.empty() && count < limit
+			   && records.size() < BATCH_BYTES_LIMIT)
+		{
+			RecordKey key = std::move(keys->second.front());
+			keys->second.pop_front();
+			auto table = findTable(key.database, key.schema, key.table);
+			if (!table)
+				continue;
+			auto search = ContestInfo::get_obj_for_search(key.candidate_id, key.contest_id);
+			auto found = table->entrySet(search, search);
+			if (found.size() != 1)
+				continue; // удалена после того, как попала в список
+			RequestObject<ContestInfo> record(RequestObject<ContestInfo>::RequestCode::ADD, found.at(0).getKey(),
+					key.database, key.schema, key.table);
+			size_t offset = records.size();
+			records.resize(offset + WireFormat::MAX_VARINT_SIZE + record.serializedSize());
+			char* end = WireFormat::writeVarint(&records[offset], record.serializedSize());
+			record.serializeTo(end);
+			records.resize(end - records.data() + record.serializedSize());
+			count++;
+			unconfirmed[range].push_back(std::move(key));
+		}
 
-				if (table->add(data, Null::value()))
-					response = "true";
-				else
-					response = "false";
-				break;
+		size_t remaining = keys == outgoing.end() ? 0 : keys->second.size();
+
+		std::string result(2 * WireFormat::MAX_VARINT_SIZE, '\0');
+		char* end = WireFormat::writeVarint(&result[0], remaining);
+		end = WireFormat::writeVarint(end, count);
+		result.resize(end - result.data());
+		return result + records;
+	}
+
+	// | varint диапазон |: новые владельцы приняли отданные записи, здесь они больше не нужны,
+	// если хранилище не остаётся владельцем диапазона
+	void commitMigration(size_t range)
+	{
+		auto batch = unconfirmed.find(range);
+		if (batch != unconfirmed.end())
+		{
+			bool keep = plan && range < plan->getRanges().size() && plan->getRanges()[range].keepsSource();
+			for (size_t i = 0; !keep && i < batch->second.size(); i++)
+			{
+				const RecordKey& key = batch->second[i];
+				auto table = findTable(key.database, key.schema, key.table);
+				if (!table)
+					continue;
+				auto search = ContestInfo::get_obj_for_search(key.candidate_id, key.contest_id);
+				std::cout << "Removed for rebalancing: " << search.serialize() << std::endl << std::endl;
+				table->remove(search);
 			}
-			case RequestObject<ContestInfo>::CONTAINS:
+			unconfirmed.erase(batch);
+		}
+		auto keys = outgoing.find(range);
+		if (keys != outgoing.end() && keys->second.empty())
+			outgoing.erase(keys);
+		if (plan && !walk && outgoing.empty() && unconfirmed.empty())
+			plan.reset();
+	}
+
+	// | varint диапазон |: пачку не перенесли, её записи снова отдаются первыми
+	void abortMigration(size_t range)
+	{
+		auto batch = unconfirmed.find(range);
+		if (batch == unconfirmed.end())
+			return;
+		auto& keys = outgoing[range];
+		keys.insert(keys.begin(), std::make_move_iterator(batch->second.begin()),
+				std::make_move_iterator(batch->second.end()));
+		unconfirmed.erase(batch);
+	}
+
+	// пачка из ответа на MIGRATE_OUT; возвращает, сколько записей добавлено.
+	// Пачка проверяется целиком до первой записи: nullopt - она обрезана, и ничего не добавлено
+	std::optional<size_t> migrateIn(std::string_view batch)
+	{
+		const char* ptr = batch.data();
+		const char* end = ptr + batch.size();
+		uint64_t remaining; // сколько осталось у старого владельца
+		uint64_t count;
+		if (!WireFormat::readVarint(ptr, end, remaining) || !WireFormat::readVarint(ptr, end, count))
+			return std::nullopt;
+		std::vector<std::string_view> records;
+		for (uint64_t i = 0; i < count; i++)
+		{
+			uint64_t length;
+			if (!WireFormat::readVarint(ptr, end, length) || length == 0
+				|| length > static_cast<uint64_t>(end - ptr))
+				return std::nullopt;
+			records.emplace_back(ptr, length);
+			ptr += length;
+		}
+		size_t added = 0;
+		for (std::string_view serialized: records)
+		{
+			RequestObject<ContestInfo>::View record(serialized);
+			added += addRecord(std::string(record.getDatabase()), std::string(record.getSchema()),
+					std::string(record.getTable()), ContestInfo::deserialize(std::string(record.getData())));
+		}
+		return added;
+	}
+
+	// ADD, CONTAINS, REMOVE, GET_KEY; ответ - данные ответа OK
+	std::string processKeyRequest(RequestObject<ContestInfo>::RequestCode requestCode, const std::string& databaseName,
+			const std::string& schemaName, const std::string& tableName, const ContestInfo& data)
+	{
+		std::string response = SharedObject::NULL_DATA;
+		switch (requestCode)
+		{
+		case RequestObject<ContestInfo>::ADD:
+		{
+			if (addRecord(databaseName, schemaName, tableName, data))
+				response = "true";
+			else
+				response = "false";
+			return response;
+		}
+		case RequestObject<ContestInfo>::CONTAINS:
+		{
+			bool contains = false;
+			auto schemas = db.get(databaseName);
+			if (schemas)
 			{
-				ContestInfo data = ContestInfo::deserialize(request.getData());
-				bool contains = false;
-				auto schemas = db.get(request.getDatabase());
-				if (schemas)
+				auto tables = schemas.value()->get(schemaName);
+				if (tables)
 				{
-					auto tables = schemas.value()->get(request.getSchema());
-					if (tables)
+					auto table = tables.value()->get(tableName);
+					if (table)
 					{
-						auto table = tables.value()->get(request.getTable());
-						if (table)
-						{
-							contains = table.value()->contains(data);
-						}
+						contains = table.value()->contains(data);
 					}
 				}
-				if (contains)
-					response = "true";
-				else
-					response = "false";
-				break;
 			}
-			case RequestObject<ContestInfo>::REMOVE:
+			if (contains)
+				response = "true";
+			else
+				response = "false";
+			return response;
+		}
+		case RequestObject<ContestInfo>::REMOVE:
+		{
+			bool removed = false;
+			auto schemas = db.get(databaseName);
+			if (schemas)
 			{
-				ContestInfo data = ContestInfo::deserialize(request.getData());
-				bool removed = false;
-				auto schemas = db.get(request.getDatabase());
-				if (schemas)
+				auto tables = schemas.value()->get(schemaName);
+				if (tables)
 				{
-					auto tables = schemas.value()->get(request.getSchema());
-					if (tables)
+					auto table = tables.value()->get(tableName);
+					if (table)
 					{
-						auto table = tables.value()->get(request.getTable());
-						if (table)
-						{
-							removed = table.value()->remove(data);
-						}
+						removed = table.value()->remove(data);
 					}
 				}
-				if (removed)
-					response = "true";
-				else
-					response = "false";
-				break;
 			}
-			case RequestObject<ContestInfo>::GET_KEY:
+			if (removed)
+				response = "true";
+			else
+				response = "false";
+			return response;
+		}
+		case RequestObject<ContestInfo>::GET_KEY:
+		{
+			auto schemas = db.get(databaseName);
+			if (schemas)
 			{
-				ContestInfo data = ContestInfo::deserialize(request.getData());
-				auto schemas = db.get(request.getDatabase());
-				if (schemas)
+				auto tables = schemas.value()->get(schemaName);
+				if (tables)
 				{
-					auto tables = schemas.value()->get(request.getSchema());
-					if (tables)
+					auto table = tables.value()->get(tableName);
+					if (table)
 					{
-						auto table = tables.value()->get(request.getTable());
-						if (table)
+						auto listVal = table.value()->entrySet(data, data);
+						if (listVal.size() == 1)
 						{
-							auto listVal = table.value()->entrySet(data, data);
-							if (listVal.size() == 1)
-							{
-								response = listVal.at(0).getKey().serialize();
-							}
+							response = listVal.at(0).getKey().serialize();
 						}
 					}
 				}
-				break;
 			}
-			case RequestObject<ContestInfo>::DELETE_DATABASE:
+			return response;
+		}
+		default:
+			throw std::runtime_error("Not a key request");
+		}
+	}
+
+	// операции пачки по порядку, как отдельные запросы; ответ - результаты в том же порядке (см. Batch)
+	// операции, до которых дошли после срока, не выполняются и получают TIMEOUT
+	// ключ маршрутизации ставит клиент, и сервер по нему выбирает хранилище и кэширует ответ:
+	// запрос с чужим ключом попал бы не в то хранилище, поэтому такой запрос не выполняется (0 - ключ не задан)
+	static bool matchesRoutingKey(uint64_t routingKey, const ContestInfo& record)
+	{
+		return routingKey == 0 || routingKey == record.hashcode();
+	}
+
+	std::string processBatch(const std::string& databaseName, const std::string& schemaName,
+			const std::string& tableName, std::string_view batch,
+			std::optional<std::chrono::steady_clock::time_point> deadline)
+	{
+		std::vector<Batch::Result> results;
+		for (const auto& operation: Batch::decode(batch))
+		{
+			Batch::Result& result = results.emplace_back();
+			if (deadline && std::chrono::steady_clock::now() >= deadline.value())
 			{
-				bool removed = db.remove(request.getDatabase());
-				if (!removed)
-				{
-					connection->sendMessage(SharedObject(this_status_code,
-							SharedObject::RequestResponseCode::ERROR, response));
-					return;
-				}
-				break;
+				result.code = SharedObject::RequestResponseCode::TIMEOUT;
+				continue;
+			}
+			if (!Batch::isKeyOperation(operation.code))
+				continue;
+			auto record = ContestInfo::deserialize(std::string(operation.data));
+			if (!matchesRoutingKey(operation.key_hash, record))
+				continue;
+			result = { SharedObject::RequestResponseCode::OK, processKeyRequest(operation.code, databaseName,
+					schemaName, tableName, record) };
+		}
+		return Batch::encodeResults(results);
+	}
+
+	// запросы, упакованные сервером, выполняются за один проход, ответы на них уходят одним кадром
+	void processPacked(const SharedObject::View& message)
+	{
+		packed_responses.emplace();
+		FramePack::forEach(message.getRawData(), [this](const char* frame, size_t size)
+		{ processMessage(SharedObject::View(frame, size)); });
+		FramePack responses = std::move(packed_responses.value());
+		packed_responses.reset();
+		connection->sendMessage(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::PACKED,
+				responses.getData(), message.getCorrelationId()));
+	}
+
+	void respond(const SharedObject::Frame& response)
+	{
+		if (packed_responses)
+			packed_responses->add(response);
+		else
+			connection->sendMessage(response);
+	}
+
+	// message указывает в память соединения и действителен до popMessage
+	void processMessage(const SharedObject::View& message)
+	{
+		std::stringstream log;
+		log << "[" << connectionName << "] Receive:" << std::endl << message.getPrint();
+		std::cout << log.str() << std::endl;
+		logger.log(log.str(), logger::severity::debug);
+
+		auto messageData = message.getData();
+
+		switch (message.getRequestResponseCode())
+		{
+		case SharedObject::STORAGE_REBALANCE:
+		{
+			// OK - когда обход под план закончится (continueMigration)
+			startMigration(MigrationPlan::deserialize(message.getRawData()), message.getCorrelationId());
+			return;
+		}
+		case SharedObject::MIGRATE_OUT:
+		{
+			auto batch = migrateOut(message.getRawData());
+			if (batch)
+				respond(SharedObject::Frame(this_status_code,
+						SharedObject::RequestResponseCode::OK, batch.value(), message.getCorrelationId()));
+			else
+				respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+						SharedObject::NULL_DATA, message.getCorrelationId()));
+			return;
+		}
+		case SharedObject::MIGRATE_IN:
+		{
+			auto added = migrateIn(message.getRawData());
+			if (added)
+				respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::OK,
+						std::to_string(added.value()), message.getCorrelationId()));
+			else
+				respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+						SharedObject::NULL_DATA, message.getCorrelationId()));
+			return;
+		}
+		case SharedObject::MIGRATE_COMMIT:
+		case SharedObject::MIGRATE_ABORT:
+		{
+			std::string_view data = message.getRawData();
+			const char* ptr = data.data();
+			uint64_t range;
+			if (!WireFormat::readVarint(ptr, data.data() + data.size(), range))
+			{
+				respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+						SharedObject::NULL_DATA, message.getCorrelationId()));
+				return;
 			}
-			case RequestObject<ContestInfo>::DELETE_SCHEMA:
+			if (message.getRequestResponseCode() == SharedObject::MIGRATE_COMMIT)
+				commitMigration(range);
+			else
+				abortMigration(range);
+			respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::OK,
+					SharedObject::NULL_DATA, message.getCorrelationId()));
+			return;
+		}
+		default:
+			break;
+		}
+
+		if (!messageData || message.getRequestResponseCode() != SharedObject::RequestResponseCode::REQUEST)
+		{
+			respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::ERROR,
+					SharedObject::NULL_DATA, message.getCorrelationId()));
+			return;
+		}
+		// срок истёк: клиент получает TIMEOUT от сервера, и ответ уже никому не нужен
+		std::optional<std::chrono::steady_clock::time_point> deadline;
+		if (auto timeout = message.getTimeout())
+			deadline = received + timeout.value();
+		if (deadline && std::chrono::steady_clock::now() >= deadline.value())
+		{
+			respond(SharedObject::Frame(this_status_code, SharedObject::RequestResponseCode::TIMEOUT,
+					SharedObject::NULL_DATA, message.getCorrelationId()));
+			return;
+		}
+		RequestObject<ContestInfo>::View request(messageData.value());
+		// ключи деревьев - std::string, короткие имена укладываются в SSO без выделения памяти
+		const std::string databaseName(request.getDatabase());
+		const std::string schemaName(request.getSchema());
+		const std::string tableName(request.getTable());
+		std::string response = SharedObject::NULL_DATA;
+
+		switch (request.getRequestCode())
+		{
+		case RequestObject<ContestInfo>::ADD:
+		case RequestObject<ContestInfo>::CONTAINS:
+		case RequestObject<ContestInfo>::REMOVE:
+		case RequestObject<ContestInfo>::GET_KEY:
+		{
+			auto record = ContestInfo::deserialize(std::string(request.getData()));
+			if (!matchesRoutingKey(message.getRoutingKey(), record))
 			{
-				bool removed = false;
-				auto schemas = db.get(request.getDatabase());
-				if (schemas)
-				{
-					removed = schemas.value()->remove(request.getSchema());
-				}
-				if (!removed)
-				{
-					connection->sendMessage(SharedObject(this_status_code,
-							SharedObject::RequestResponseCode::ERROR, response));
-					return;
-				}
-				break;
+				respond(SharedObject::Frame(this_status_code,
+						SharedObject::RequestResponseCode::ERROR, response, message.getCorrelationId()));
+				return;
 			}
-			case RequestObject<ContestInfo>::DELETE_TABLE:
+			response = processKeyRequest(request.getRequestCode(), databaseName, schemaName, tableName, record);
+			break;
+		}
+		case RequestObject<ContestInfo>::BATCH:
+		{
+			response = processBatch(databaseName, schemaName, tableName, request.getData(), deadline);
+			break;
+		}
+		case RequestObject<ContestInfo>::DELETE_DATABASE:
+		{
+			bool removed = db.remove(databaseName);
+			if (!removed)
 			{
-				bool removed = false;
-				auto schemas = db.get(request.getDatabase());
-				if (schemas)
-				{
-					auto tables = schemas.value()->get(request.getSchema());
-					if (tables)
-					{
-						removed = tables.value()->remove(request.getTable());
-					}
-				}
-				if (!removed)
+				respond(SharedObject::Frame(this_status_code,
+						SharedObject::RequestResponseCode::ERROR, response, message.getCorrelationId()));
+				return;
+			}
+			break;
+		}
+		case RequestObject<ContestInfo>::DELETE_SCHEMA:
+		{
+			bool removed = false;
+			auto schemas = db.get(databaseName);
+			if (schemas)
+			{
+				removed = schemas.value()->remove(schemaName);
+			}
+			if (!removed)
+			{
+				respond(SharedObject::Frame(this_status_code,
+						SharedObject::RequestResponseCode::ERROR, response, message.getCorrelationId()));
+				return;
+			}
+			break;
+		}
+		case RequestObject<ContestInfo>::DELETE_TABLE:
+		{
+			bool removed = false;
+			auto schemas = db.get(databaseName);
+			if (schemas)
+			{
+				auto tables = schemas.value()->get(schemaName);
+				if (tables)
 				{
-					connection->sendMessage(SharedObject(this_status_code,
-							SharedObject::RequestResponseCode::ERROR, response));
-					return;
+					removed = tables.value()->remove(tableName);
 				}
 			}
-			default:
+			if (!removed)
 			{
-				connection->sendMessage(SharedObject(this_status_code,
-						SharedObject::RequestResponseCode::ERROR, response));
-			}
+				respond(SharedObject::Frame(this_status_code,
+						SharedObject::RequestResponseCode::ERROR, response, message.getCorrelationId()));
+				return;
 			}
-			connection->sendMessage(SharedObject(this_status_code,
-					SharedObject::RequestResponseCode::OK, response));
+			break;
+		}
+		default:
+		{
+			respond(SharedObject::Frame(this_status_code,
+					SharedObject::RequestResponseCode::ERROR, response, message.getCorrelationId()));
+			return;
+		}
 		}
+		respond(SharedObject::Frame(this_status_code,
+				SharedObject::RequestResponseCode::OK, response, message.getCorrelationId()));
 	}
 };
 